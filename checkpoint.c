@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2005-2010 Denise H. G. <darcsis@gmail.com>
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * --checkpoint and --resume: the stack of the walk, with where it is
+ * in every directory on it, is saved every few seconds and when
+ * interrupted, so a later run can go on from there. a directory is
+ * read again on resuming and the walk goes on from the name that was
+ * next, so a save costs a name per directory, however large. with
+ * --stream, whose children are visited as they are read, the names of
+ * the subdirectories left are saved instead.
+ */
+
+#include "search.h"
+
+#define CKPT_MAGIC "search checkpoint 2\n"
+
+/* seconds between two checkpoints */
+#define CKPT_INTERVAL 5
+
+/* set by the signal handlers, looked at by the walk */
+volatile sig_atomic_t ckpt_due;
+
+extern int  arena_add(arena_t *, const char *);
+extern int  snap_sig(int, char **, arena_t *);
+
+static void ckpt_signal(int);
+static int  ckpt_put(FILE *, const void *, size_t);
+static int  ckpt_get(const char **, const char *, void *, size_t);
+static int  ckpt_load(ckpt_t *, arena_t *, int);
+
+int  init_checkpoint(const char *, int, int, char **, plan_t *);
+int  ckpt_save(walk_t *, plan_t *);
+void ckpt_part(walk_t *, frame_t *, unsigned long, plan_t *);
+int  ckpt_frame(frame_t *, unsigned long *, plan_t *);
+void ckpt_seek(frame_t *, plan_t *);
+void ckpt_finish(plan_t *);
+void free_checkpoint(ckpt_t **);
+
+static void
+ckpt_signal(int sig)
+{
+  ckpt_due = (sig == SIGALRM) ? CKPT_TIMER : CKPT_STOP;
+}
+
+static int
+ckpt_put(FILE *fp, const void *buf, size_t len)
+{
+  return ((fwrite(buf, 1, len, fp) == len) ? (0) : (-1));
+}
+
+static int
+ckpt_get(const char **s, const char *end, void *buf, size_t len)
+{
+  if ((size_t)(end - *s) < len)
+	return (-1);
+
+  memcpy(buf, *s, len);
+  *s += len;
+
+  return (0);
+}
+
+static int
+ckpt_load(ckpt_t *ck, arena_t *sig, int stream)
+{
+  int i;
+  uint32_t n, len, fl, j;
+  int32_t depth;
+  uint64_t u;
+  long size;
+  char *buf;
+  const char *s, *end;
+  cframe_t *cf;
+  FILE *fp;
+
+  if ((fp = fopen(ck->path, "r")) == NULL) {
+	warn("%s", ck->path);
+	return (-1);
+  }
+
+  if (fseek(fp, 0, SEEK_END) < 0 || (size = ftell(fp)) < 0 ||
+	  (buf = (char *)malloc(size + 1)) == NULL) {
+	warn("%s", ck->path);
+	fclose(fp);
+	return (-1);
+  }
+  rewind(fp);
+  if (fread(buf, 1, size, fp) != (size_t)size) {
+	warn("%s", ck->path);
+	fclose(fp);
+	free(buf);
+	return (-1);
+  }
+  fclose(fp);
+  buf[size] = '\0';
+
+  s = buf;
+  end = buf + size;
+  len = strlen(CKPT_MAGIC);
+  if ((size_t)size < len || memcmp(s, CKPT_MAGIC, len) != 0)
+	goto bad;
+  s += len;
+
+  if (ckpt_get(&s, end, &n, sizeof(n)) < 0 ||
+	  n != sig->len || (size_t)(end - s) < n ||
+	  memcmp(s, sig->buf, n) != 0) {
+	warnx("%s: saved with other options", ck->path);
+	free(buf);
+	return (-1);
+  }
+  s += n;
+
+  if (ckpt_get(&s, end, &u, sizeof(u)) < 0)
+	goto bad;
+  ck->nmatch = u;
+  if (ckpt_get(&s, end, &u, sizeof(u)) < 0)
+	goto bad;
+  ck->root = u;
+  if (ckpt_get(&s, end, &n, sizeof(n)) < 0 || n > (size_t)size)
+	goto bad;
+
+  if ((ck->frames = (cframe_t *)calloc(n + 1, sizeof(cframe_t))) == NULL)
+	goto bad;
+
+  for (i = 0; i < (int)n; i++) {
+	cf = &(ck->frames[i]);
+	ck->nframes++;
+	if (ckpt_get(&s, end, &len, sizeof(len)) < 0 ||
+		(size_t)(end - s) < len ||
+		(cf->path = strndup(s, len)) == NULL)
+	  goto bad;
+	s += len;
+	if (ckpt_get(&s, end, &depth, sizeof(depth)) < 0 ||
+		ckpt_get(&s, end, &fl, sizeof(fl)) < 0)
+	  goto bad;
+	cf->depth = depth;
+	cf->deldir = fl;
+	if (ckpt_get(&s, end, &fl, sizeof(fl)) < 0 ||
+		ckpt_get(&s, end, &u, sizeof(u)) < 0)
+	  goto bad;
+	cf->partial = fl;
+	cf->nread = u;
+	if (!stream) {
+	  if (ckpt_get(&s, end, &u, sizeof(u)) < 0 ||
+		  ckpt_get(&s, end, &len, sizeof(len)) < 0 ||
+		  (size_t)(end - s) < len ||
+		  (len > 0 && (cf->name = strndup(s, len)) == NULL))
+		goto bad;
+	  cf->cur = u;
+	  s += len;
+	  continue;
+	}
+	if (ckpt_get(&s, end, &len, sizeof(len)) < 0)
+	  goto bad;
+	for (j = 0; j < len; j++) {
+	  if (ckpt_get(&s, end, &fl, sizeof(fl)) < 0 ||
+		  memchr(s, '\0', end - s) == NULL ||
+		  arena_add(&(cf->names), s) < 0)
+		goto bad;
+	  cf->names.recs[cf->names.nrecs - 1].flags = fl;
+	  s += strlen(s) + 1;
+	}
+  }
+
+  free(buf);
+  return (0);
+
+ bad:
+  warnx("%s: damaged checkpoint", ck->path);
+  free(buf);
+  return (-1);
+}
+
+/*
+ * save to `file' as the walk goes, after going on from where it was
+ * when `resume' is set.
+ */
+int
+init_checkpoint(const char *file, int resume, int argc, char **argv,
+				plan_t *p)
+{
+  size_t len;
+  ckpt_t *ck;
+
+  if (file == NULL || p == NULL)
+	return (-1);
+
+  if ((ck = (ckpt_t *)malloc(sizeof(ckpt_t))) == NULL)
+	return (-1);
+  bzero(ck, sizeof(ckpt_t));
+
+  len = strlen(file) + 10;
+  if ((ck->path = strdup(file)) == NULL ||
+	  (ck->tmppath = (char *)malloc(len)) == NULL ||
+	  snap_sig(argc, argv, &(ck->sig)) < 0) {
+	free_checkpoint(&ck);
+	return (-1);
+  }
+  snprintf(ck->tmppath, len, "%s.tmp", file);
+
+  if (resume && ckpt_load(ck, &(ck->sig), p->args->need_stream) < 0) {
+	free_checkpoint(&ck);
+	return (-1);
+  }
+
+  p->ckpt = ck;
+  p->nmatch = ck->nmatch;
+
+  signal(SIGINT, ckpt_signal);
+  signal(SIGTERM, ckpt_signal);
+  signal(SIGALRM, ckpt_signal);
+  alarm(CKPT_INTERVAL);
+
+  return (0);
+}
+
+/*
+ * called between two nodes, when every name before `cur' in a frame
+ * has been walked through along with everything below it.
+ */
+int
+ckpt_save(walk_t *w, plan_t *p)
+{
+  int i;
+  int32_t depth;
+  uint32_t n, fl;
+  uint64_t u;
+  size_t j;
+  frame_t *f;
+  ckpt_t *ck;
+  FILE *fp;
+
+  if ((ck = p->ckpt) == NULL)
+	return (-1);
+
+  /* what has been printed must be out before it is counted */
+  (void)fflush(stdout);
+
+  if ((fp = fopen(ck->tmppath, "w")) == NULL) {
+	warn("%s", ck->tmppath);
+	goto done;
+  }
+
+  n = (uint32_t)ck->sig.len;
+  u = p->nmatch;
+  if (ckpt_put(fp, CKPT_MAGIC, strlen(CKPT_MAGIC)) < 0 ||
+	  ckpt_put(fp, &n, sizeof(n)) < 0 ||
+	  ckpt_put(fp, ck->sig.buf, ck->sig.len) < 0 ||
+	  ckpt_put(fp, &u, sizeof(u)) < 0)
+	goto fail;
+  u = p->root;
+  n = (uint32_t)(w->top + 1);
+  if (ckpt_put(fp, &u, sizeof(u)) < 0 ||
+	  ckpt_put(fp, &n, sizeof(n)) < 0)
+	goto fail;
+
+  for (i = 0; i <= w->top; i++) {
+	f = w->stack[i];
+	n = (uint32_t)f->len;
+	depth = f->depth;
+	fl = f->deldir;
+	if (ckpt_put(fp, &n, sizeof(n)) < 0 ||
+		ckpt_put(fp, w->path, f->len) < 0 ||
+		ckpt_put(fp, &depth, sizeof(depth)) < 0 ||
+		ckpt_put(fp, &fl, sizeof(fl)) < 0)
+	  goto fail;
+	fl = f->partial;
+	u = f->partial ? f->nread : 0;
+	if (ckpt_put(fp, &fl, sizeof(fl)) < 0 ||
+		ckpt_put(fp, &u, sizeof(u)) < 0)
+	  goto fail;
+	/* a directory read in part is read again from the start */
+	if (!p->args->need_stream) {
+	  u = f->partial ? 0 : f->names.cur;
+	  n = (!f->partial && f->names.cur < f->names.nrecs) ?
+		(uint32_t)f->names.recs[f->names.cur].len : 0;
+	  if (ckpt_put(fp, &u, sizeof(u)) < 0 ||
+		  ckpt_put(fp, &n, sizeof(n)) < 0 ||
+		  (n > 0 &&
+		   ckpt_put(fp, f->names.buf + f->names.recs[f->names.cur].off,
+					n) < 0))
+		goto fail;
+	  continue;
+	}
+	n = (uint32_t)(f->names.nrecs - f->names.cur);
+	if (ckpt_put(fp, &n, sizeof(n)) < 0)
+	  goto fail;
+	for (j = f->names.cur; j < f->names.nrecs; j++) {
+	  fl = f->names.recs[j].flags;
+	  if (ckpt_put(fp, &fl, sizeof(fl)) < 0 ||
+		  ckpt_put(fp, f->names.buf + f->names.recs[j].off,
+				   f->names.recs[j].len + 1) < 0)
+		goto fail;
+	}
+  }
+
+  if (fclose(fp) == EOF) {
+	warn("%s", ck->tmppath);
+	goto done;
+  }
+  if (rename(ck->tmppath, ck->path) < 0)
+	warn("%s", ck->path);
+  goto done;
+
+ fail:
+  warn("%s", ck->tmppath);
+  fclose(fp);
+  (void)unlink(ck->tmppath);
+
+ done:
+  if (ckpt_due == CKPT_STOP) {
+	ck->stopped = 1;
+	p->stop = 1;
+  }
+  ckpt_due = 0;
+  alarm(CKPT_INTERVAL);
+
+  return (0);
+}
+
+/*
+ * the same, while the directory of `f' is read and before it is on
+ * the stack. with --stream, the children of its first `nread'
+ * entries have been visited.
+ */
+void
+ckpt_part(walk_t *w, frame_t *f, unsigned long nread, plan_t *p)
+{
+  ckpt_t *ck;
+
+  if ((ck = p->ckpt) == NULL)
+	return;
+
+  /*
+   * the frames above it are not back yet, and would be lost; the
+   * checkpoint resumed from is still good to stop with.
+   */
+  if (ck->resuming && ck->next + 1 < ck->nframes) {
+	if (ckpt_due == CKPT_STOP) {
+	  ck->stopped = 1;
+	  p->stop = 1;
+	  ckpt_due = 0;
+	}
+	return;
+  }
+
+  f->partial = 1;
+  f->nread = nread;
+  w->top++;
+  ckpt_save(w, p);
+  w->top--;
+  f->partial = 0;
+}
+
+/*
+ * while the stack is rebuilt, take the names of a frame saved with
+ * --stream instead of reading its directory, and tell how many
+ * entries to pass over in one saved while it was read. returns 1 if
+ * it is not to be read.
+ */
+int
+ckpt_frame(frame_t *f, unsigned long *skip, plan_t *p)
+{
+  size_t i;
+  cframe_t *cf;
+  ckpt_t *ck;
+
+  *skip = 0;
+  if ((ck = p->ckpt) == NULL || !ck->resuming || !p->args->need_stream)
+	return (0);
+
+  cf = &(ck->frames[ck->next]);
+  for (i = 0; i < cf->names.nrecs; i++) {
+	if (arena_add(&(f->names), cf->names.buf + cf->names.recs[i].off) == 0)
+	  f->names.recs[f->names.nrecs - 1].flags = cf->names.recs[i].flags;
+  }
+
+  if (!cf->partial)
+	return (1);
+
+  *skip = cf->nread;
+  return (0);
+}
+
+/*
+ * once a frame saved without --stream is read again, go on from the
+ * name that was next, or from the same position if it is gone.
+ */
+void
+ckpt_seek(frame_t *f, plan_t *p)
+{
+  size_t i;
+  cframe_t *cf;
+  ckpt_t *ck;
+
+  if ((ck = p->ckpt) == NULL || !ck->resuming || p->args->need_stream)
+	return;
+
+  cf = &(ck->frames[ck->next]);
+  if (cf->partial)
+	return;
+
+  if (cf->name == NULL) {
+	f->names.cur = f->names.nrecs;
+	return;
+  }
+
+  f->names.cur = (cf->cur < f->names.nrecs) ? cf->cur : f->names.nrecs;
+  for (i = 0; i < f->names.nrecs; i++) {
+	if (strcmp(f->names.buf + f->names.recs[i].off, cf->name) == 0) {
+	  f->names.cur = i;
+	  break;
+	}
+  }
+}
+
+/* a walk to the end leaves nothing to resume */
+void
+ckpt_finish(plan_t *p)
+{
+  ckpt_t *ck;
+
+  if (p == NULL || (ck = p->ckpt) == NULL)
+	return;
+
+  alarm(0);
+  if (!ck->stopped)
+	(void)unlink(ck->path);
+}
+
+void
+free_checkpoint(ckpt_t **ckpt)
+{
+  int i;
+  ckpt_t *ck = *ckpt;
+
+  if (ck == NULL)
+	return;
+
+  for (i = 0; i < ck->nframes; i++) {
+	free(ck->frames[i].path);
+	free(ck->frames[i].name);
+	free(ck->frames[i].names.buf);
+	free(ck->frames[i].names.recs);
+  }
+  free(ck->frames);
+  free(ck->sig.buf);
+  free(ck->sig.recs);
+  free(ck->path);
+  free(ck->tmppath);
+  free(ck);
+  *ckpt = NULL;
+}
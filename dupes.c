@@ -0,0 +1,567 @@
+/*
+ * Copyright (c) 2005-2010 Denise H. G. <darcsis@gmail.com>
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * --duplicates: regular files are grouped by size as they are found,
+ * and, once the walk is done, the files of a size shared by others
+ * are hashed with XXH64, first their head, then, where the heads
+ * agree, the whole of them. files whose hashes agree are compared
+ * byte for byte, and a group of files with the same contents is
+ * printed out per line. names of the same inode count as one file.
+ */
+
+#include <fcntl.h>
+
+#include "search.h"
+
+/* what is hashed of every candidate first */
+#define HEADSIZE 4096
+/* a multiple of the 32 bytes of an XXH64 stripe */
+#define READSIZE (128 * 1024)
+
+#define XXH_P1 0x9e3779b185ebca87ULL
+#define XXH_P2 0xc2b2ae3d27d4eb4fULL
+#define XXH_P3 0x165667b19e3779f9ULL
+#define XXH_P4 0x85ebca77c2b2ae63ULL
+#define XXH_P5 0x27d4eb2f165667c5ULL
+#define XXH_ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* the state of XXH64 with a seed of 0 */
+struct _xxh {
+  uint64_t v[4];
+  uint64_t total;
+};
+
+extern int arena_add(arena_t *, const char *);
+
+static const char *names;
+static char *rbuf, *cbuf;
+
+static __inline uint64_t xxh_round(uint64_t, uint64_t);
+static void xxh_init(struct _xxh *);
+static void xxh_stripes(struct _xxh *, const char *, size_t);
+static uint64_t xxh_final(struct _xxh *, const char *, size_t);
+static int  dupe_hash(const char *, off_t, uint64_t *);
+static int  dupe_read(int, char *, const char *);
+static int  dupe_cmp(const char *, const char *);
+static int  dupe_sizecmp(const void *, const void *);
+static int  dupe_inocmp(const void *, const void *);
+static int  dupe_hashcmp(const void *, const void *);
+static int  dupe_namecmp(const void *, const void *);
+static int  dupe_stage(dupe_t *, size_t, off_t, plan_t *);
+static void dupe_print(dupe_t *, size_t, plan_t *);
+static void dupe_verify(dupe_t *, size_t, plan_t *);
+static void dupe_group(dupe_t *, size_t, plan_t *);
+
+int  init_dupes(plan_t *);
+int  dupe_add(const char *, plan_t *);
+void dupe_finish(plan_t *);
+void free_dupes(dupes_t **);
+
+int
+init_dupes(plan_t *p)
+{
+  dupes_t *d;
+
+  if (p == NULL)
+	return (-1);
+
+  if ((d = (dupes_t *)malloc(sizeof(dupes_t))) == NULL) {
+	warn("--duplicates");
+	return (-1);
+  }
+  bzero(d, sizeof(dupes_t));
+  p->dupes = d;
+
+  return (0);
+}
+
+/* keep a result if it is a regular file with anything in it */
+int
+dupe_add(const char *name, plan_t *p)
+{
+  dupes_t *d;
+  dupe_t *tmp;
+
+  if (name == NULL || p == NULL || (d = p->dupes) == NULL)
+	return (-1);
+
+  if (p->nstat->type != NT_ISREG || p->nstat->size == 0)
+	return (0);
+
+  if (d->nrecs == d->maxrecs) {
+	d->maxrecs = (d->maxrecs == 0) ? 256 : d->maxrecs * 2;
+	if ((tmp = (dupe_t *)realloc(d->recs,
+								 d->maxrecs * sizeof(dupe_t))) == NULL) {
+	  warn("--duplicates");
+	  return (-1);
+	}
+	d->recs = tmp;
+  }
+
+  if (arena_add(&(d->names), name) < 0)
+	return (-1);
+
+  tmp = &(d->recs[d->nrecs++]);
+  tmp->size = p->nstat->size;
+  tmp->dev = p->nstat->dev;
+  tmp->ino = p->nstat->ino;
+  tmp->off = d->names.recs[d->names.nrecs - 1].off;
+  tmp->hash = 0;
+  tmp->bad = 0;
+
+  return (0);
+}
+
+/*
+ * XXH64 as specified by its author, the words in the byte order of
+ * the host: the hashes never leave the process.
+ */
+static __inline uint64_t
+xxh_round(uint64_t acc, uint64_t v)
+{
+  acc += v * XXH_P2;
+  acc = XXH_ROTL(acc, 31);
+  return (acc * XXH_P1);
+}
+
+static void
+xxh_init(struct _xxh *x)
+{
+  x->v[0] = XXH_P1 + XXH_P2;
+  x->v[1] = XXH_P2;
+  x->v[2] = 0;
+  x->v[3] = -XXH_P1;
+  x->total = 0;
+}
+
+/* `len' is a multiple of 32 */
+static void
+xxh_stripes(struct _xxh *x, const char *buf, size_t len)
+{
+  size_t i;
+  uint64_t v;
+
+  for (i = 0; i < len; i += 8) {
+	memcpy(&v, buf + i, 8);
+	x->v[(i / 8) & 3] = xxh_round(x->v[(i / 8) & 3], v);
+  }
+  x->total += len;
+}
+
+/* the hash, with the last `len' bytes, fewer than 32 */
+static uint64_t
+xxh_final(struct _xxh *x, const char *buf, size_t len)
+{
+  int i;
+  size_t off;
+  uint32_t w;
+  uint64_t h, v;
+
+  if (x->total >= 32) {
+	h = XXH_ROTL(x->v[0], 1) + XXH_ROTL(x->v[1], 7) +
+	  XXH_ROTL(x->v[2], 12) + XXH_ROTL(x->v[3], 18);
+	for (i = 0; i < 4; i++) {
+	  h ^= xxh_round(0, x->v[i]);
+	  h = h * XXH_P1 + XXH_P4;
+	}
+  } else
+	h = XXH_P5;
+  h += x->total + len;
+
+  for (off = 0; off + 8 <= len; off += 8) {
+	memcpy(&v, buf + off, 8);
+	h ^= xxh_round(0, v);
+	h = XXH_ROTL(h, 27) * XXH_P1 + XXH_P4;
+  }
+  if (off + 4 <= len) {
+	memcpy(&w, buf + off, 4);
+	h ^= (uint64_t)w * XXH_P1;
+	h = XXH_ROTL(h, 23) * XXH_P2 + XXH_P3;
+	off += 4;
+  }
+  for (; off < len; off++) {
+	h ^= (unsigned char)buf[off] * XXH_P5;
+	h = XXH_ROTL(h, 11) * XXH_P1;
+  }
+
+  h ^= h >> 33;
+  h *= XXH_P2;
+  h ^= h >> 29;
+  h *= XXH_P3;
+  h ^= h >> 32;
+
+  return (h);
+}
+
+/*
+ * the hash of the first `len' bytes of a file, or of all of it when
+ * `len' is 0. the buffer is filled before it is hashed, so only the
+ * last one may end short of a stripe.
+ */
+static int
+dupe_hash(const char *name, off_t len, uint64_t *hash)
+{
+  int fd;
+  ssize_t n;
+  size_t fill, want, nstripes;
+  uint64_t total;
+  struct _xxh x;
+
+  if (rbuf == NULL && (rbuf = (char *)malloc(READSIZE)) == NULL) {
+	warn("--duplicates");
+	return (-1);
+  }
+
+  if ((fd = open(name, O_RDONLY)) < 0) {
+	warn("%s", name);
+	return (-1);
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (len == 0)
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  xxh_init(&x);
+  total = 0;
+  for (;;) {
+	want = READSIZE;
+	if (len > 0 && (off_t)(total + want) > len)
+	  want = (size_t)(len - total);
+	for (fill = 0; fill < want; fill += n) {
+	  if ((n = read(fd, rbuf + fill, want - fill)) < 0) {
+		warn("%s", name);
+		close(fd);
+		return (-1);
+	  }
+	  if (n == 0)
+		break;
+	}
+
+	nstripes = fill & ~(size_t)31;
+	xxh_stripes(&x, rbuf, nstripes);
+
+	total += fill;
+	if (fill < READSIZE || (len > 0 && (off_t)total >= len))
+	  break;
+  }
+
+  close(fd);
+  *hash = xxh_final(&x, rbuf + nstripes, fill - nstripes);
+
+  return (0);
+}
+
+/* fill `buf' from `fd' as far as it goes, the bytes read or -1 */
+static int
+dupe_read(int fd, char *buf, const char *name)
+{
+  ssize_t n;
+  size_t fill;
+
+  for (fill = 0; fill < READSIZE; fill += n) {
+	if ((n = read(fd, buf + fill, READSIZE - fill)) < 0) {
+	  warn("%s", name);
+	  return (-1);
+	}
+	if (n == 0)
+	  break;
+  }
+
+  return ((int)fill);
+}
+
+/*
+ * 0 if the two files have the same bytes, 1 if not, -1 if `a' could
+ * not be read and -2 if `b' could not.
+ */
+static int
+dupe_cmp(const char *a, const char *b)
+{
+  int fa, fb, na, nb, ret;
+
+  if (cbuf == NULL && (cbuf = (char *)malloc(READSIZE)) == NULL) {
+	warn("--duplicates");
+	return (-1);
+  }
+
+  if ((fa = open(a, O_RDONLY)) < 0) {
+	warn("%s", a);
+	return (-1);
+  }
+  if ((fb = open(b, O_RDONLY)) < 0) {
+	warn("%s", b);
+	close(fa);
+	return (-2);
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  (void)posix_fadvise(fa, 0, 0, POSIX_FADV_SEQUENTIAL);
+  (void)posix_fadvise(fb, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  for (;;) {
+	if ((na = dupe_read(fa, rbuf, a)) < 0) {
+	  ret = -1;
+	  break;
+	}
+	if ((nb = dupe_read(fb, cbuf, b)) < 0) {
+	  ret = -2;
+	  break;
+	}
+	if (na != nb || memcmp(rbuf, cbuf, na) != 0) {
+	  ret = 1;
+	  break;
+	}
+	if (na < READSIZE) {
+	  ret = 0;
+	  break;
+	}
+  }
+
+  close(fa);
+  close(fb);
+  return (ret);
+}
+
+/* the biggest first, the names of an inode next to each other */
+static int
+dupe_sizecmp(const void *a, const void *b)
+{
+  const dupe_t *x = a, *y = b;
+
+  if (x->size != y->size)
+	return ((x->size > y->size) ? -1 : 1);
+
+  return (dupe_inocmp(a, b));
+}
+
+/* also the order to read them in */
+static int
+dupe_inocmp(const void *a, const void *b)
+{
+  const dupe_t *x = a, *y = b;
+
+  if (x->dev != y->dev)
+	return ((x->dev < y->dev) ? -1 : 1);
+  if (x->ino != y->ino)
+	return ((x->ino < y->ino) ? -1 : 1);
+  if (x->off != y->off)
+	return ((x->off < y->off) ? -1 : 1);
+
+  return (0);
+}
+
+static int
+dupe_hashcmp(const void *a, const void *b)
+{
+  const dupe_t *x = a, *y = b;
+
+  if (x->bad != y->bad)
+	return ((x->bad < y->bad) ? -1 : 1);
+  if (x->hash != y->hash)
+	return ((x->hash < y->hash) ? -1 : 1);
+
+  return (dupe_inocmp(a, b));
+}
+
+static int
+dupe_namecmp(const void *a, const void *b)
+{
+  const dupe_t *x = a, *y = b;
+
+  return (strcmp(names + x->off, names + y->off));
+}
+
+/*
+ * hash `n' files of the same size, up to `len' bytes of them, and
+ * sort them by it. those that could not be read go last. returns
+ * how many were hashed.
+ */
+static int
+dupe_stage(dupe_t *recs, size_t n, off_t len, plan_t *p)
+{
+  size_t i, nbad;
+
+  qsort(recs, n, sizeof(dupe_t), dupe_inocmp);
+
+  for (i = nbad = 0; i < n; i++) {
+	if (dupe_hash(names + recs[i].off, len, &(recs[i].hash)) < 0) {
+	  recs[i].bad = 1;
+	  p->nfailed++;
+	  nbad++;
+	}
+  }
+
+  qsort(recs, n, sizeof(dupe_t), dupe_hashcmp);
+
+  return ((int)(n - nbad));
+}
+
+static void
+dupe_print(dupe_t *recs, size_t n, plan_t *p)
+{
+  size_t i;
+
+  qsort(recs, n, sizeof(dupe_t), dupe_namecmp);
+
+  for (i = 0; i < n; i++)
+	(void)fprintf(stdout, "%s%s", (i > 0) ? "\t" : "",
+				  names + recs[i].off);
+  (void)fprintf(stdout, "\n");
+
+  p->dupes->ngroups++;
+}
+
+/*
+ * `n' files whose hashes agree: print those that are the same byte
+ * for byte as groups, taking each file left in turn to compare the
+ * others with. one that cannot be read is left out.
+ */
+static void
+dupe_verify(dupe_t *recs, size_t n, plan_t *p)
+{
+  int ret;
+  size_t i, same;
+  dupe_t tmp;
+
+  while (n >= 2) {
+	/* those like the first go right after it */
+	for (i = 1, same = 1; i < n; i++) {
+	  if ((ret = dupe_cmp(names + recs[0].off, names + recs[i].off)) == -1)
+		break;
+	  if (ret == -2) {
+		p->nfailed++;
+		tmp = recs[i];
+		recs[i--] = recs[--n];
+		recs[n] = tmp;
+	  } else if (ret == 0) {
+		tmp = recs[same];
+		recs[same++] = recs[i];
+		recs[i] = tmp;
+	  }
+	}
+	if (i < n) {
+	  p->nfailed++;
+	  recs++;
+	  n--;
+	  continue;
+	}
+
+	if (same >= 2)
+	  dupe_print(recs, same, p);
+	recs += same;
+	n -= same;
+  }
+}
+
+/*
+ * `n' files of one size, an inode each: split them by the hash of
+ * their heads, and the groups left of bigger files by the hash of
+ * all of them, before they are compared.
+ */
+static void
+dupe_group(dupe_t *recs, size_t n, plan_t *p)
+{
+  size_t i, j, k, l, nhead, nfull;
+  off_t size;
+
+  size = recs[0].size;
+  nhead = (size_t)dupe_stage(recs, n, (size > HEADSIZE) ? HEADSIZE : 0, p);
+
+  for (i = 0; i < nhead; i = j) {
+	for (j = i + 1; j < nhead && recs[j].hash == recs[i].hash; j++)
+	  ;
+	if (j - i < 2)
+	  continue;
+
+	/* the head was all of it */
+	if (size <= HEADSIZE) {
+	  dupe_verify(&recs[i], j - i, p);
+	  continue;
+	}
+
+	nfull = (size_t)dupe_stage(&recs[i], j - i, 0, p);
+	for (k = i; k < i + nfull; k = l) {
+	  for (l = k + 1; l < i + nfull && recs[l].hash == recs[k].hash; l++)
+		;
+	  if (l - k >= 2)
+		dupe_verify(&recs[k], l - k, p);
+	}
+  }
+}
+
+void
+dupe_finish(plan_t *p)
+{
+  size_t i, j, k, n;
+  dupes_t *d;
+  dupe_t *recs;
+
+  if (p == NULL || (d = p->dupes) == NULL || d->nrecs == 0)
+	return;
+
+  recs = d->recs;
+  names = d->names.buf;
+  qsort(recs, d->nrecs, sizeof(dupe_t), dupe_sizecmp);
+
+  for (i = 0; i < d->nrecs; i = j) {
+	for (j = i + 1; j < d->nrecs && recs[j].size == recs[i].size; j++)
+	  ;
+	if (j - i < 2)
+	  continue;
+
+	/* one name per inode, the first one found */
+	for (k = i + 1, n = 1; k < j; k++) {
+	  if (recs[k].dev == recs[i + n - 1].dev &&
+		  recs[k].ino == recs[i + n - 1].ino)
+		continue;
+	  recs[i + n++] = recs[k];
+	}
+	if (n >= 2)
+	  dupe_group(&recs[i], n, p);
+  }
+
+  free(rbuf);
+  free(cbuf);
+  rbuf = cbuf = NULL;
+}
+
+void
+free_dupes(dupes_t **dupes)
+{
+  dupes_t *d = *dupes;
+
+  if (d == NULL)
+	return;
+
+  free(d->names.buf);
+  free(d->names.recs);
+  free(d->recs);
+  free(d);
+  *dupes = NULL;
+}
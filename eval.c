@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2005-2010 Denise H. G. <darcsis@gmail.com>
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * specialized evaluators for the most common sets of filters, chosen
+ * once by add_plan(). they take the place of the PLAN list in visit(),
+ * with the pattern compiled and the flags worked
+ * out beforehand, instead of on every node.
+ */
+
+#include <sysexits.h>
+
+#include "search.h"
+
+/* the filters run on every node, beside stat and lstat */
+#define EV_FILTERS (OPT_EMPTY | OPT_GRP | OPT_USR | OPT_XDEV | OPT_DEL | \
+					OPT_NAME | OPT_REGEX | OPT_TYPE | OPT_NGRP | OPT_NUSR | \
+					OPT_EXEC | OPT_SIZE | OPT_TIME | OPT_PERM | OPT_LINKS | \
+					OPT_FSTYPE)
+
+extern int s_stat(const char *, plan_t *);
+extern int s_lstat(const char *, plan_t *);
+
+static __inline const char *ev_base(const char *);
+static __inline int ev_name(const char *, eval_t *);
+static __inline int ev_regex(const char *, eval_t *);
+
+int  init_eval(plan_t *);
+void free_eval(eval_t **);
+
+/* the last name, as nodename() in functions.c; it never writes to it */
+static __inline const char *
+ev_base(const char *name)
+{
+  const char *s;
+
+  return (((s = strrchr(name, '/')) != NULL && s[1] != '\0') ? s + 1 : name);
+}
+
+static __inline int
+ev_name(const char *name, eval_t *ev)
+{
+  return (fnmatch(ev->pattern, ev_base(name), ev->fnflags) == 0);
+}
+
+/* the whole name has to match, as with s_regex() */
+static __inline int
+ev_regex(const char *name, eval_t *ev)
+{
+  int ret;
+  regoff_t len;
+  char msg[LINE_MAX];
+  const char *base;
+  regmatch_t pmatch;
+
+  base = ev_base(name);
+  len = (regoff_t)strlen(base);
+  pmatch.rm_so = 0;
+  pmatch.rm_eo = len;
+
+  ret = regexec(&(ev->re), base, 1, &pmatch, REG_STARTEND);
+  if (ret != 0 && ret != REG_NOMATCH) {
+	if (regerror(ret, &(ev->re), msg, LINE_MAX) > 0)
+	  errx(1, "%s: %s", ev->pattern, msg);
+	else
+	  errx(1, "%s", ev->pattern);
+  }
+
+  return (ret == 0 && pmatch.rm_so == 0 && pmatch.rm_eo == len);
+}
+
+/*
+ * the node is always looked at, as its type decides whether to
+ * descend, but filtered only when `mine', as in visit().
+ */
+#define EVALUATOR(fn, test)									\
+static int													\
+fn(const char *name, plan_t *p, int mine)					\
+{															\
+  eval_t *ev = p->eval;										\
+															\
+  if (ev->stat(name, p) != 0)								\
+	return (-1);											\
+  if (!mine)												\
+	return (0);												\
+															\
+  return ((test) ? (0) : (-1));								\
+}
+
+#define TYPE  (p->nstat->type == ev->type)
+#define NAME  (ev_name(name, ev))
+#define REGEX (ev_regex(name, ev))
+#define USER  (p->nstat->uid == ev->uid)
+#define EMPTY (p->nstat->empty)
+
+EVALUATOR(ev_all, 1)
+EVALUATOR(ev_n, NAME)
+EVALUATOR(ev_tn, TYPE && NAME)
+EVALUATOR(ev_tr, TYPE && REGEX)
+EVALUATOR(ev_ut, TYPE && USER)
+EVALUATOR(ev_et, TYPE && EMPTY)
+
+#undef TYPE
+#undef NAME
+#undef REGEX
+#undef USER
+#undef EMPTY
+
+/*
+ * called before plan_add() takes the flags. p->eval is left NULL
+ * unless the filters are one of the sets above.
+ */
+int
+init_eval(plan_t *p)
+{
+  unsigned int fl;
+  int ret;
+  char msg[LINE_MAX];
+  eval_t *ev;
+
+  if (p == NULL || p->eval != NULL)
+	return (-1);
+
+  /* nothing will be walked through */
+  if (p->flags & (OPT_VERSION | OPT_USAGE))
+	return (0);
+
+  fl = p->flags & EV_FILTERS;
+
+  /* the default name pattern, without -I, matches everything */
+  if ((fl & OPT_NAME) && p->mt->pattern[0] == '\0' &&
+	  !(p->mt->mflag & REG_ICASE))
+	fl &= ~OPT_NAME;
+
+  if ((ev = (eval_t *)malloc(sizeof(eval_t))) == NULL)
+	return (-1);
+  bzero(ev, sizeof(eval_t));
+
+  switch (fl) {
+  case OPT_NONE:
+	ev->fn = &ev_all;
+	break;
+  case OPT_NAME:
+	ev->fn = &ev_n;
+	break;
+  case OPT_TYPE | OPT_NAME:
+	ev->fn = &ev_tn;
+	break;
+  case OPT_TYPE | OPT_REGEX:
+	ev->fn = &ev_tr;
+	break;
+  case OPT_TYPE | OPT_USR:
+	ev->fn = &ev_ut;
+	break;
+  case OPT_TYPE | OPT_EMPTY:
+	ev->fn = &ev_et;
+	break;
+  default:
+	free(ev);
+	return (0);
+  }
+
+  ev->stat = (p->flags & OPT_STAT) ? &s_stat : &s_lstat;
+  ev->type = p->args->type;
+
+  /* as s_name() does */
+  ev->pattern = (p->mt->pattern[0] != '\0') ? p->mt->pattern : "*";
+  if (p->mt->mflag & REG_ICASE)
+	ev->fnflags = FNM_CASEFOLD | FNM_PERIOD | FNM_PATHNAME | FNM_NOESCAPE;
+
+  if (fl & OPT_REGEX) {
+	if (p->mt->pattern[0] == '\0')
+	  ev->pattern = ".*";
+	if ((ret = regcomp(&(ev->re), ev->pattern, p->mt->mflag)) != 0) {
+	  if (regerror(ret, &(ev->re), msg, LINE_MAX) > 0)
+		errx(EX_DATAERR, "-r %s: %s", ev->pattern, msg);
+	  else
+		errx(EX_DATAERR, "-r %s", ev->pattern);
+	}
+	ev->hasre = 1;
+  }
+
+  if (fl & OPT_USR)
+	ev->uid = p->args->uid;
+
+#ifdef _DEBUG_
+  warnx("specialized evaluator for filters 0x%x", fl);
+#endif
+
+  p->eval = ev;
+  return (0);
+}
+
+void
+free_eval(eval_t **eval)
+{
+  eval_t *ev = *eval;
+
+  if (ev == NULL)
+	return;
+
+  if (ev->hasre)
+	regfree(&(ev->re));
+  free(ev);
+  *eval = NULL;
+}
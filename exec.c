@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2005-2010 Denise H. G. <darcsis@gmail.com>
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * --exec: run a command on every result, or on as many results at
+ * once as ARG_MAX allows, keeping up to --jobs of them running.
+ */
+
+#include <sys/wait.h>
+
+#include <spawn.h>
+
+#include "search.h"
+
+extern char **environ;
+
+extern int arena_add(arena_t *, const char *);
+
+static void exec_reap(exec_t *, plan_t *);
+static void exec_spawn(exec_t *, char **, plan_t *);
+static void exec_batch(exec_t *, plan_t *);
+
+int  init_exec(int *, char **, plan_t *);
+int  exec_add(const char *, plan_t *);
+void exec_finish(plan_t *);
+void free_exec(exec_t **);
+
+/*
+ * take `--exec command ... ;' or `--exec command ... {} +' out of
+ * argv before getopt_long(3) gets to see, and reorder, it.
+ */
+int
+init_exec(int *argc, char **argv, plan_t *p)
+{
+  int i, j, k;
+  size_t envlen;
+  long argmax;
+  exec_t *ex;
+
+  for (i = 1; i < *argc; i++)
+	if (strcmp(argv[i], "--exec") == 0)
+	  break;
+  if (i == *argc)
+	return (0);
+
+  for (j = i + 1; j < *argc; j++)
+	if (strcmp(argv[j], ";") == 0 || strcmp(argv[j], "+") == 0)
+	  break;
+
+  if (j == *argc || j == i + 1) {
+	warnx("--exec: missing command or terminating `;' or `+'");
+	return (-1);
+  }
+
+  if ((ex = (exec_t *)malloc(sizeof(exec_t))) == NULL)
+	return (-1);
+  bzero(ex, sizeof(exec_t));
+
+  ex->argc = j - i - 1;
+  ex->batch = (argv[j][0] == '+');
+  if ((ex->argv = (char **)calloc(ex->argc + 1, sizeof(char *))) == NULL ||
+	  (ex->av = (char **)calloc(ex->argc + 1, sizeof(char *))) == NULL) {
+	free(ex->argv);
+	free(ex);
+	return (-1);
+  }
+
+  ex->used = 0;
+  for (k = 0; k < ex->argc; k++) {
+	ex->argv[k] = argv[i + 1 + k];
+	ex->used += strlen(ex->argv[k]) + 1 + sizeof(char *);
+  }
+
+  /* like POSIX find(1), `{}' must come last with `+' */
+  if (ex->batch && strcmp(ex->argv[ex->argc - 1], "{}") != 0) {
+	warnx("--exec: `{}' must be right before `+'");
+	free_exec(&ex);
+	return (-1);
+  }
+
+  if (ex->batch) {
+	ex->argc--;
+	ex->used -= 3 + sizeof(char *);
+	ex->argv[ex->argc] = NULL;
+  }
+
+  /* leave room for the environment, as xargs(1) does */
+  if ((argmax = sysconf(_SC_ARG_MAX)) < 0)
+	argmax = _POSIX_ARG_MAX;
+  for (envlen = 0, k = 0; environ[k] != NULL; k++)
+	envlen += strlen(environ[k]) + 1 + sizeof(char *);
+  /* an environment that big leaves next to nothing, try with that */
+  if ((size_t)argmax > envlen + 4096 + _POSIX_ARG_MAX / 2)
+	ex->argmax = (size_t)argmax - envlen - 4096;
+  else
+	ex->argmax = _POSIX_ARG_MAX / 2;
+
+  /* drop the --exec words from argv */
+  for (k = j + 1; k < *argc; k++)
+	argv[i + k - j - 1] = argv[k];
+  *argc -= j - i + 1;
+  argv[*argc] = NULL;
+
+  ex->njobs = 1;
+  p->exec = ex;
+
+  return (0);
+}
+
+static void
+exec_reap(exec_t *ex, plan_t *p)
+{
+  int status;
+  pid_t pid;
+
+  if ((pid = waitpid(-1, &status, 0)) < 0) {
+	warn("--exec");
+	ex->nrunning = 0;
+	return;
+  }
+
+  ex->nrunning--;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	p->nfailed++;
+}
+
+/* wait for a free job slot, holding the walk back until then */
+static void
+exec_spawn(exec_t *ex, char **av, plan_t *p)
+{
+  int ret;
+  pid_t pid;
+
+  while (ex->nrunning >= ex->njobs)
+	exec_reap(ex, p);
+
+  (void)fflush(stdout);
+  if ((ret = posix_spawnp(&pid, av[0], NULL, NULL, av, environ)) != 0) {
+	errno = ret;
+	warn("--exec: %s", av[0]);
+	p->nfailed++;
+	return;
+  }
+
+  ex->nrunning++;
+}
+
+static void
+exec_batch(exec_t *ex, plan_t *p)
+{
+  int i;
+  size_t n;
+  char **av;
+
+  if (ex->names.nrecs == 0)
+	return;
+
+  if ((av = (char **)malloc((ex->argc + ex->names.nrecs + 1) *
+							sizeof(char *))) == NULL) {
+	warn("--exec");
+	return;
+  }
+
+  for (i = 0; i < ex->argc; i++)
+	av[i] = ex->argv[i];
+  for (n = 0; n < ex->names.nrecs; n++)
+	av[i + n] = ex->names.buf + ex->names.recs[n].off;
+  av[i + n] = NULL;
+
+  exec_spawn(ex, av, p);
+  free(av);
+
+  ex->names.len = ex->names.nrecs = 0;
+  ex->nbytes = 0;
+}
+
+int
+exec_add(const char *name, plan_t *p)
+{
+  int i;
+  size_t need;
+  exec_t *ex;
+
+  if (name == NULL || p == NULL || (ex = p->exec) == NULL)
+	return (-1);
+
+  if (!ex->batch) {
+	for (i = 0; i < ex->argc; i++)
+	  ex->av[i] = (strcmp(ex->argv[i], "{}") == 0) ?
+		(char *)name : ex->argv[i];
+	ex->av[i] = NULL;
+	exec_spawn(ex, ex->av, p);
+	return (0);
+  }
+
+  need = strlen(name) + 1 + sizeof(char *);
+  if (ex->used + ex->nbytes + need > ex->argmax)
+	exec_batch(ex, p);
+
+  ex->nbytes += need;
+  return (arena_add(&(ex->names), name));
+}
+
+void
+exec_finish(plan_t *p)
+{
+  exec_t *ex;
+
+  if (p == NULL || (ex = p->exec) == NULL)
+	return;
+
+  if (ex->batch)
+	exec_batch(ex, p);
+
+  while (ex->nrunning > 0)
+	exec_reap(ex, p);
+}
+
+void
+free_exec(exec_t **exec)
+{
+  exec_t *ex = *exec;
+
+  if (ex == NULL)
+	return;
+
+  free(ex->argv);
+  free(ex->av);
+  free(ex->names.buf);
+  free(ex->names.recs);
+  free(ex);
+  *exec = NULL;
+}
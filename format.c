@@ -0,0 +1,503 @@
+/*
+ * Copyright (c) 2005-2010 Denise H. G. <darcsis@gmail.com>
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * --printf and --json-lines: the format is compiled once into a
+ * list of ops, which are run on the nstat_t of every result.
+ */
+
+#include <grp.h>
+#include <pwd.h>
+#include <time.h>
+
+#include "search.h"
+
+#define NNAMES 256
+
+static const char *json =
+  "{\"path\":%p,\"type\":%y,\"size\":%s,\"user\":%u,\"group\":%g,"
+  "\"uid\":%U,\"gid\":%G,\"mtime\":%T,\"inode\":%i}\n";
+
+/*
+ * uid or gid to name, looked up once each. an id without a name is
+ * kept as its number, so that it is not looked up again either.
+ */
+struct _idname {
+  unsigned int used;
+  unsigned long id;
+  char *name;
+};
+
+static struct _idtab {
+  struct _idname *tab;
+  size_t n;
+  size_t size;
+} unames, gnames;
+
+static char *buf;
+static size_t buflen, bufsize;
+
+static int  fmt_op(fmt_t *, int, const char *, size_t);
+static int  id_grow(struct _idtab *);
+static const char *idname(struct _idtab *, unsigned long, int);
+static size_t utf8len(const unsigned char *);
+static void emit(const char *, size_t);
+static void emit_str(const char *, int);
+static void emit_num(unsigned long long, int);
+
+int  init_fmt(const char *, int, plan_t *);
+const char *fmt_render(const char *, plan_t *, size_t *);
+void free_fmt(fmt_t **);
+
+static int
+fmt_op(fmt_t *fmt, int op, const char *lit, size_t len)
+{
+  fop_t *tmp;
+
+  if (fmt->nops == fmt->maxops) {
+	fmt->maxops = (fmt->maxops == 0) ? 16 : fmt->maxops * 2;
+	if ((tmp = (fop_t *)realloc(fmt->ops,
+								fmt->maxops * sizeof(fop_t))) == NULL)
+	  return (-1);
+	fmt->ops = tmp;
+  }
+
+  fmt->ops[fmt->nops].op = op;
+  fmt->ops[fmt->nops].lit = lit;
+  fmt->ops[fmt->nops].len = len;
+  fmt->nops++;
+
+  return (0);
+}
+
+/*
+ * compile `format', or the --json-lines one when `jsonl' is set.
+ * literal text points into a copy of the format, unescaped in
+ * place.
+ */
+int
+init_fmt(const char *format, int jsonl, plan_t *p)
+{
+  int op;
+  char *s, *d, *lit;
+  fmt_t *fmt;
+
+  if (p == NULL)
+	return (-1);
+
+  if (p->fmt != NULL)
+	free_fmt(&(p->fmt));
+
+  if ((fmt = (fmt_t *)malloc(sizeof(fmt_t))) == NULL)
+	return (-1);
+  bzero(fmt, sizeof(fmt_t));
+  fmt->json = jsonl;
+
+  if ((fmt->text = strdup(jsonl ? json : format)) == NULL) {
+	free(fmt);
+	return (-1);
+  }
+
+  lit = d = fmt->text;
+  for (s = fmt->text; *s != '\0'; s++) {
+
+	if (*s == '\\' && !jsonl) {
+	  switch (*++s) {
+	  case 'n':
+		*d++ = '\n';
+		break;
+	  case 't':
+		*d++ = '\t';
+		break;
+	  case '\\':
+		*d++ = '\\';
+		break;
+	  case '\0':
+		s--;
+		*d++ = '\\';
+		break;
+	  default:
+		*d++ = '\\';
+		*d++ = *s;
+		break;
+	  }
+	  continue;
+	}
+
+	if (*s != '%') {
+	  *d++ = *s;
+	  continue;
+	}
+
+	switch (*++s) {
+	case '%':
+	  *d++ = '%';
+	  continue;
+	case 'p':
+	  op = F_PATH;
+	  break;
+	case 'f':
+	  op = F_BASE;
+	  break;
+	case 's':
+	  op = F_SIZE;
+	  fmt->need |= NS_SIZE;
+	  break;
+	case 'u':
+	  op = F_USER;
+	  fmt->need |= NS_UID;
+	  break;
+	case 'g':
+	  op = F_GROUP;
+	  fmt->need |= NS_GID;
+	  break;
+	case 'U':
+	  op = F_UID;
+	  fmt->need |= NS_UID;
+	  break;
+	case 'G':
+	  op = F_GID;
+	  fmt->need |= NS_GID;
+	  break;
+	case 'T':
+	  op = F_MTIME;
+	  fmt->need |= NS_MTIME;
+	  break;
+	case 't':
+	  op = F_MDATE;
+	  fmt->need |= NS_MTIME;
+	  break;
+	case 'y':
+	  op = F_TYPE;
+	  break;
+	case 'i':
+	  op = F_INO;
+	  fmt->need |= NS_INO;
+	  break;
+	default:
+	  warnx("--printf: %%%c: unknown directive", (*s != '\0') ? *s : ' ');
+	  free_fmt(&fmt);
+	  return (-1);
+	}
+
+	if (d > lit && fmt_op(fmt, F_LIT, lit, d - lit) < 0)
+	  goto nomem;
+	if (fmt_op(fmt, op, NULL, 0) < 0)
+	  goto nomem;
+	lit = d;
+  }
+
+  if (d > lit && fmt_op(fmt, F_LIT, lit, d - lit) < 0)
+	goto nomem;
+
+  p->fmt = fmt;
+  return (0);
+
+ nomem:
+  warn("--printf");
+  free_fmt(&fmt);
+  return (-1);
+}
+
+/* twice the size, kept at most half full */
+static int
+id_grow(struct _idtab *t)
+{
+  size_t i, n, size;
+  struct _idname *tab;
+
+  size = (t->size == 0) ? NNAMES : t->size * 2;
+  if ((tab = (struct _idname *)calloc(size, sizeof(struct _idname))) == NULL)
+	return (-1);
+
+  for (i = 0; i < t->size; i++) {
+	if (!t->tab[i].used)
+	  continue;
+	for (n = t->tab[i].id % size; tab[n].used; n = (n + 1) % size)
+	  ;
+	tab[n] = t->tab[i];
+  }
+
+  free(t->tab);
+  t->tab = tab;
+  t->size = size;
+  return (0);
+}
+
+/* the name of `id', or NULL only when out of memory */
+static const char *
+idname(struct _idtab *t, unsigned long id, int user)
+{
+  size_t n;
+  struct passwd *pw;
+  struct group *gr;
+  const char *name;
+  char num[32];
+
+  if (t->n + 1 > t->size / 2 && id_grow(t) < 0)
+	return (NULL);
+
+  for (n = id % t->size; t->tab[n].used; n = (n + 1) % t->size) {
+	if (t->tab[n].id == id)
+	  return (t->tab[n].name);
+  }
+
+  name = NULL;
+  if (user) {
+	if ((pw = getpwuid((uid_t)id)) != NULL)
+	  name = pw->pw_name;
+  } else {
+	if ((gr = getgrgid((gid_t)id)) != NULL)
+	  name = gr->gr_name;
+  }
+
+  if (name == NULL) {
+	snprintf(num, sizeof(num), "%lu", id);
+	name = num;
+  }
+  if ((name = strdup(name)) == NULL)
+	return (NULL);
+
+  t->tab[n].used = 1;
+  t->tab[n].id = id;
+  t->tab[n].name = (char *)name;
+  t->n++;
+
+  return (name);
+}
+
+static void
+emit(const char *s, size_t len)
+{
+  char *tmp;
+
+  if (buflen + len + 1 > bufsize) {
+	while (buflen + len + 1 > bufsize)
+	  bufsize = (bufsize == 0) ? LINE_MAX : bufsize * 2;
+	if ((tmp = (char *)realloc(buf, bufsize)) == NULL)
+	  err(1, "--printf");
+	buf = tmp;
+  }
+
+  memcpy(buf + buflen, s, len);
+  buflen += len;
+  buf[buflen] = '\0';
+}
+
+/* length of the UTF-8 sequence at `s', 0 if it is not a valid one */
+static size_t
+utf8len(const unsigned char *s)
+{
+  size_t i, len;
+  unsigned int c;
+
+  if (s[0] < 0x80)
+	return (1);
+  else if (s[0] >= 0xc2 && s[0] <= 0xdf)
+	len = 2;
+  else if (s[0] >= 0xe0 && s[0] <= 0xef)
+	len = 3;
+  else if (s[0] >= 0xf0 && s[0] <= 0xf4)
+	len = 4;
+  else
+	return (0);
+
+  c = s[0] & (0x7f >> len);
+  for (i = 1; i < len; i++) {
+	if ((s[i] & 0xc0) != 0x80)
+	  return (0);
+	c = (c << 6) | (s[i] & 0x3f);
+  }
+
+  /* overlong, surrogates and past U+10FFFF */
+  if ((len == 3 && c < 0x800) || (len == 4 && c < 0x10000) ||
+	  (c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+	return (0);
+
+  return (len);
+}
+
+/*
+ * quoted for JSON. a byte that is not part of valid UTF-8 is written
+ * as \u00XX of its value, since JSON text can only be Unicode.
+ */
+static void
+emit_str(const char *s, int quote)
+{
+  char esc[8];
+  const char *t;
+  size_t len;
+
+  if (!quote) {
+	emit(s, strlen(s));
+	return;
+  }
+
+  emit("\"", 1);
+  for (t = s; *s != '\0'; s += len) {
+	len = utf8len((const unsigned char *)s);
+	if (len > 1 ||
+		(len == 1 && (unsigned char)*s >= 0x20 && *s != '"' && *s != '\\'))
+	  continue;
+	emit(t, s - t);
+	snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*s);
+	emit(esc, strlen(esc));
+	len = 1;
+	t = s + 1;
+  }
+  emit(t, s - t);
+  emit("\"", 1);
+}
+
+static void
+emit_num(unsigned long long n, int quote)
+{
+  char num[32];
+
+  snprintf(num, sizeof(num), quote ? "\"%llu\"" : "%llu", n);
+  emit(num, strlen(num));
+}
+
+/* the output of one result, in a buffer valid until the next call */
+const char *
+fmt_render(const char *name, plan_t *p, size_t *len)
+{
+  int i;
+  const char *s;
+  char date[64];
+  static time_t last = -1;
+  static char lastdate[64];
+  struct tm *tm;
+  nstat_t *ns;
+  fop_t *op;
+
+  ns = p->nstat;
+  buflen = 0;
+  emit("", 0);
+
+  for (i = 0; i < p->fmt->nops; i++) {
+	op = &(p->fmt->ops[i]);
+	switch (op->op) {
+	case F_LIT:
+	  emit(op->lit, op->len);
+	  break;
+	case F_PATH:
+	  emit_str(name, p->fmt->json);
+	  break;
+	case F_BASE:
+	  s = strrchr(name, '/');
+	  emit_str((s != NULL && s[1] != '\0') ? s + 1 : name, p->fmt->json);
+	  break;
+	case F_SIZE:
+	  emit_num((unsigned long long)ns->size, 0);
+	  break;
+	case F_USER:
+	  if ((s = idname(&unames, ns->uid, 1)) != NULL)
+		emit_str(s, p->fmt->json);
+	  else
+		emit_num(ns->uid, p->fmt->json);
+	  break;
+	case F_GROUP:
+	  if ((s = idname(&gnames, ns->gid, 0)) != NULL)
+		emit_str(s, p->fmt->json);
+	  else
+		emit_num(ns->gid, p->fmt->json);
+	  break;
+	case F_UID:
+	  emit_num(ns->uid, 0);
+	  break;
+	case F_GID:
+	  emit_num(ns->gid, 0);
+	  break;
+	case F_MTIME:
+	  emit_num((unsigned long long)ns->mtime, 0);
+	  break;
+	case F_MDATE:
+	  /* files of a tree tend to share their mtime */
+	  if (ns->mtime != last) {
+		if ((tm = localtime(&(ns->mtime))) == NULL ||
+			strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", tm) == 0)
+		  date[0] = '\0';
+		strlcpy(lastdate, date, sizeof(lastdate));
+		last = ns->mtime;
+	  }
+	  emit_str(lastdate, p->fmt->json);
+	  break;
+	case F_TYPE:
+	  switch (ns->type) {
+	  case NT_ISREG:  s = "f"; break;
+	  case NT_ISDIR:  s = "d"; break;
+	  case NT_ISLNK:  s = "l"; break;
+	  case NT_ISFIFO: s = "p"; break;
+	  case NT_ISCHR:  s = "c"; break;
+	  case NT_ISBLK:  s = "b"; break;
+	  case NT_ISSOCK: s = "s"; break;
+	  default:        s = "U"; break;
+	  }
+	  emit_str(s, p->fmt->json);
+	  break;
+	case F_INO:
+	  emit_num((unsigned long long)ns->ino, 0);
+	  break;
+	}
+  }
+
+  *len = buflen;
+  return (buf);
+}
+
+void
+free_fmt(fmt_t **fmt)
+{
+  size_t i;
+  fmt_t *f = *fmt;
+
+  if (f == NULL)
+	return;
+
+  free(f->ops);
+  free(f->text);
+  free(f);
+  *fmt = NULL;
+
+  for (i = 0; i < unames.size; i++) {
+	if (unames.tab[i].used)
+	  free(unames.tab[i].name);
+  }
+  for (i = 0; i < gnames.size; i++) {
+	if (gnames.tab[i].used)
+	  free(gnames.tab[i].name);
+  }
+  free(unames.tab);
+  free(gnames.tab);
+  bzero(&unames, sizeof(unames));
+  bzero(&gnames, sizeof(gnames));
+
+  free(buf);
+  buf = NULL;
+  buflen = bufsize = 0;
+}
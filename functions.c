@@ -25,6 +25,7 @@
  *
  */
 
+#include <fcntl.h>
 #include <grp.h>
 #include <libgen.h>
 #include <pwd.h>
@@ -32,11 +33,61 @@
 
 #include "search.h"
 
-static __inline void out(const char *);
-static void dislink(const char *, NODE);
+static __inline void out(const char *, plan_t *);
+static void dislink(int, const char *, const char *, NODE, plan_t *);
+static void delnode(const char *, NODE, plan_t *);
+static void stats(plan_t *);
+static void devstat(DIR *, unsigned long, struct timespec *,
+					unsigned long long, plan_t *);
 static int  regexcomp(match_t *);
-static int  nodestat(const char *, plan_t *, int (*) (const char *, struct stat *));
+static int  statnode(int, const char *, struct stat *, int, plan_t *);
+static int  nodestat(const char *, plan_t *, int);
+static DIR *diropen(const char *, plan_t *);
+static int  pruned(const char *, plan_t *);
+static __inline const char *nodename(const char *);
+static unsigned int shard_of(const char *, unsigned int);
+static int  filter(PLAN *, const char *, plan_t *, int);
+static int  visit(const char *, plan_t *, int);
+static size_t pathcat(walk_t *, size_t, const char *);
+static size_t dset_hash(dev_t, ino_t, size_t);
+static dino_t *dset_find(dset_t *, dev_t, ino_t);
+static dino_t *dset_add(dset_t *, dev_t, ino_t);
+static void dset_del(dset_t *, dev_t, ino_t);
+static int  dset_check(frame_t *, const char *, plan_t *);
+static int  enter(walk_t *, size_t, int, unsigned int, plan_t *);
+static void leave(walk_t *, plan_t *);
+static void resume(walk_t *, plan_t *);
+static void snap_note(frame_t *, const char *, int, plan_t *);
+static int  nrec_cmp(const char *, nrec_t *, nrec_t *, size_t);
+static int  nrec_inocmp(const void *, const void *);
+static void inode_order(frame_t *, int);
 static void walk_through(const char *, plan_t *);
+static void list_through(const char *, plan_t *);
+
+extern int push_ignore(const char *, istack_t *, plan_t *);
+extern int ignored(const char *, size_t, int, plan_t *);
+extern int gsort_add(const char *, plan_t *);
+extern int gsort_finish(plan_t *);
+extern int exec_add(const char *, plan_t *);
+extern void exec_finish(plan_t *);
+extern const char *fmt_render(const char *, plan_t *, size_t *);
+extern unsigned int mount_flags(dev_t, plan_t *);
+extern void free_mounts(mtab_t **);
+extern int snap_lookup(frame_t *, plan_t *);
+extern void snap_record(frame_t *, arena_t *, plan_t *);
+extern void snap_finish(plan_t *);
+extern int ckpt_save(walk_t *, plan_t *);
+extern void ckpt_part(walk_t *, frame_t *, unsigned long, plan_t *);
+extern int ckpt_frame(frame_t *, unsigned long *, plan_t *);
+extern void ckpt_seek(frame_t *, plan_t *);
+extern void ckpt_finish(plan_t *);
+extern void plan_reorder(plist_t *);
+extern int init_uring(plan_t *);
+extern pstat_t *uring_stat(frame_t *, size_t, plan_t *);
+extern void uring_drain(frame_t *);
+extern int dupe_add(const char *, plan_t *);
+extern void dupe_finish(plan_t *);
+extern volatile sig_atomic_t ckpt_due;
 
 
 int s_getids(const char *, plan_t *);
@@ -50,13 +101,35 @@ int s_empty(const char *, plan_t *);
 int s_xdev(const char *, plan_t *);
 int s_sort(const char *, plan_t *);
 int s_delete(const char *, plan_t *);
+int s_exec(const char *, plan_t *);
 int s_path(const char *, plan_t *);
+int s_size(const char *, plan_t *);
+int s_time(const char *, plan_t *);
+int s_perm(const char *, plan_t *);
+int s_links(const char *, plan_t *);
+int s_fstype(const char *, plan_t *);
 int s_nogroup(const char *, plan_t *);
 int s_nouser(const char *, plan_t *);
 int s_version(const char *, plan_t *);
 int s_usage(const char *, plan_t *);
+int arena_add(arena_t *, const char *);
+void arena_sort(arena_t *);
+#ifdef STATX_TYPE
+unsigned int statx_mask(plan_t *);
+void statx_conv(const struct statx *, struct stat *);
+#endif
 
 #define NIDS 2048
+/* directories kept open for *at() lookups of their children */
+#define NOPENDIRS 64
+/* nodes between two orderings of the free filters, and one in
+   NTIMED of them has its filters timed */
+#define NREORDER 4096
+#define NTIMED 16
+/* stdio buffer of the --files-from list */
+#define LISTBUF (1024 * 1024)
+
+#define INRANGE(v, r) ((long long)(v) >= (r).lo && (long long)(v) <= (r).hi)
 
 static struct passwd *pwd;
 static struct group *grp;
@@ -66,10 +139,31 @@ static struct _ids {
 } ids;
 
 static __inline void
-out(const char *s)
+out(const char *s, plan_t *p)
 {
+  size_t len;
+
   if (s == NULL)
 	return;
+
+  if (p->dupes != NULL) {
+	dupe_add(s, p);
+	return;
+  }
+
+  if (p->fmt != NULL) {
+	s = fmt_render(s, p, &len);
+	if (p->args->need_gsort)
+	  gsort_add(s, p);
+	else
+	  (void)fwrite(s, 1, len, stdout);
+	return;
+  }
+
+  if (p->args->need_gsort) {
+	gsort_add(s, p);
+	return;
+  }
   
   (void)fprintf(stdout, "%s\n", s);
 }
@@ -109,8 +203,12 @@ s_getids(const char *name __unused, plan_t *p __unused)
   return (errno == 0? 0 : -1);
 }
 
+/*
+ * `rel' is `path' relative to the directory `fd', which is
+ * AT_FDCWD when walk_through() holds no directory above it.
+ */
 static void
-dislink(const char *path, NODE type)
+dislink(int fd, const char *rel, const char *path, NODE type, plan_t *p)
 {  
   if (path == NULL)
 	return;
@@ -120,18 +218,121 @@ dislink(const char *path, NODE type)
 	return;
   
 #ifdef _DEBUG_
-  warnx("dislink(%s): %s: to be deleted.", path, path);
+  warnx("dislink(%s): %s: to be deleted.", path, rel);
 #endif
   
   if(type == NT_ISDIR) {
-	if (rmdir(path) < 0) {
+	if (unlinkat(fd, rel, AT_REMOVEDIR) < 0) {
 	  warn("--rmdir(%s)", path);
+	  p->nfailed++;
+	  return;
 	}
   } else {
-	if (unlink(path) < 0) {
+	if (unlinkat(fd, rel, 0) < 0) {
 	  warn("--unlink(%s)", path);
+	  p->nfailed++;
+	  return;
 	}
   }
+
+  p->ndeleted++;
+}
+
+/* delete the node being visited */
+static void
+delnode(const char *name, NODE type, plan_t *p)
+{
+  if (p->pfd >= 0)
+	dislink(p->pfd, name + p->poff, name, type, p);
+  else
+	dislink(AT_FDCWD, name, name, type, p);
+}
+
+static void
+stats(plan_t *p)
+{
+  unsigned int i, n;
+  double secs;
+  devstat_t *d;
+  PLAN *pn;
+
+  (void)fprintf(stderr, "results: %lu\n", p->nmatch);
+  (void)fprintf(stderr, "deleted: %lu\n", p->ndeleted);
+  (void)fprintf(stderr, "failed: %lu\n", p->nfailed);
+  if (p->snap != NULL)
+	(void)fprintf(stderr, "unchanged: %lu\n", p->snap->nreused);
+  if (p->dupes != NULL)
+	(void)fprintf(stderr, "duplicates: %lu\n", p->dupes->ngroups);
+
+  /* the order the free filters ended up in, and how many they passed */
+  if (p->eval == NULL) {
+	n = 0;
+	for (pn = p->plans->start; pn != NULL; pn = pn->next) {
+	  if (!pn->free)
+		continue;
+	  (void)fprintf(stderr, "%s%s", (n++ == 0) ? "filters: " : ", ",
+					pn->func_name);
+	  if (pn->ncalls > 0)
+		(void)fprintf(stderr, " %.1f%%",
+					  100.0 * (pn->ncalls - pn->nfails) / pn->ncalls);
+	}
+	if (n > 0)
+	  (void)fprintf(stderr, "\n");
+  }
+
+  for (i = 0; i < p->ndevs; i++) {
+	d = &(p->devs[i]);
+	secs = d->nsecs / 1e9;
+	(void)fprintf(stderr,
+				  "device %lu,%lu: %lu directories, %lu entries, %.3fs",
+				  (unsigned long)major(d->dev), (unsigned long)minor(d->dev),
+				  d->ndirs, d->nentries, secs);
+	if (secs > 0)
+	  (void)fprintf(stderr, ", %.0f entries/s", d->nentries / secs);
+	(void)fprintf(stderr, "\n");
+  }
+}
+
+/*
+ * account a directory read since `t0' to its device, but for `nvisit'
+ * nanoseconds spent visiting its children. a walk seldom crosses more
+ * than a few devices, so they are simply kept in an array.
+ */
+static void
+devstat(DIR *dirp, unsigned long nentries, struct timespec *t0,
+		unsigned long long nvisit, plan_t *p)
+{
+  long long nsecs;
+  unsigned int i;
+  struct stat stbuf;
+  struct timespec t1;
+  devstat_t *d;
+
+  if (fstat(dirfd(dirp), &stbuf) < 0 ||
+	  clock_gettime(CLOCK_MONOTONIC, &t1) < 0)
+	return;
+
+  for (i = 0; i < p->ndevs; i++)
+	if (p->devs[i].dev == stbuf.st_dev)
+	  break;
+
+  if (i == p->ndevs) {
+	if ((d = (devstat_t *)realloc(p->devs,
+								  (p->ndevs + 1) * sizeof(devstat_t))) == NULL)
+	  return;
+	p->devs = d;
+	bzero(&(p->devs[i]), sizeof(devstat_t));
+	p->devs[i].dev = stbuf.st_dev;
+	p->ndevs++;
+  }
+
+  d = &(p->devs[i]);
+  d->ndirs++;
+  d->nentries += nentries;
+  nsecs = (t1.tv_sec - t0->tv_sec) * 1000000000LL +
+	(t1.tv_nsec - t0->tv_nsec) - (long long)nvisit;
+  if (nsecs > 0)
+	d->nsecs += nsecs;
 }
 
 static int
@@ -179,9 +380,101 @@ regexcomp(match_t *mt)
 	return (-1);
 }
 
+/*
+ * open a directory relative to its parent's descriptor when
+ * walk_through() still holds it, saving the kernel a lookup
+ * of every leading path component.
+ */
+static DIR *
+diropen(const char *name, plan_t *p)
+{
+  int fd;
+  DIR *dirp;
+
+  if (p->pfd < 0)
+	return (opendir(name));
+
+  if ((fd = openat(p->pfd, name + p->poff, O_RDONLY | O_DIRECTORY)) < 0)
+	return (NULL);
+
+  if ((dirp = fdopendir(fd)) == NULL)
+	close(fd);
+
+  return (dirp);
+}
+
+/*
+ * where statx(2) is available, only ask for the fields the plan
+ * needs, so network file systems need not revalidate the rest.
+ */
+#ifdef STATX_TYPE
+unsigned int
+statx_mask(plan_t *p)
+{
+  unsigned int mask;
+
+  mask = STATX_TYPE;
+  if (p->args->need_stat & NS_UID)
+	mask |= STATX_UID;
+  if (p->args->need_stat & NS_GID)
+	mask |= STATX_GID;
+  if (p->args->need_stat & NS_SIZE)
+	mask |= STATX_SIZE;
+  if (p->args->need_stat & NS_MTIME)
+	mask |= STATX_MTIME;
+  if (p->args->need_stat & NS_CTIME)
+	mask |= STATX_CTIME;
+  if (p->args->need_stat & NS_ATIME)
+	mask |= STATX_ATIME;
+  if (p->args->need_stat & NS_MODE)
+	mask |= STATX_MODE;
+  if (p->args->need_stat & NS_NLINK)
+	mask |= STATX_NLINK;
+  if (p->args->need_stat & NS_INO)
+	mask |= STATX_INO;
+
+  return (mask);
+}
+
+void
+statx_conv(const struct statx *stx, struct stat *sb)
+{
+  bzero(sb, sizeof(struct stat));
+  sb->st_mode = stx->stx_mode;
+  sb->st_uid = stx->stx_uid;
+  sb->st_gid = stx->stx_gid;
+  sb->st_size = stx->stx_size;
+  sb->st_mtime = stx->stx_mtime.tv_sec;
+  sb->st_ctime = stx->stx_ctime.tv_sec;
+  sb->st_atime = stx->stx_atime.tv_sec;
+  sb->st_nlink = stx->stx_nlink;
+  sb->st_ino = stx->stx_ino;
+  sb->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+}
+#endif
+
 static int
-nodestat(const char *name, plan_t *p,
-	int (*stat_f) (const char *s, struct stat *buf))
+statnode(int fd, const char *name, struct stat *sb, int atflag, plan_t *p)
+{
+#ifdef STATX_TYPE
+  int ret;
+  struct statx stx;
+
+  if (p->args->nosync)
+	atflag |= AT_STATX_DONT_SYNC;
+
+  if ((ret = statx(fd, name, atflag, statx_mask(p), &stx)) < 0)
+	return (ret);
+
+  statx_conv(&stx, sb);
+  return (0);
+#else
+  return (fstatat(fd, name, sb, atflag));
+#endif
+}
+
+static int
+nodestat(const char *name, plan_t *p, int atflag)
 {
   int ret;
   static struct stat stbuf;
@@ -192,12 +485,21 @@ nodestat(const char *name, plan_t *p,
 	return (NT_ERROR);
   if (p == NULL)
 	return (NT_ERROR);
-  if (stat_f == NULL)
-	return (NT_ERROR);
   if (p->nstat == NULL)
 	return (NT_ERROR);
 
-  if ((ret = stat_f(name, &stbuf)) < 0) {
+  if (p->pst != NULL && p->pst->done) {
+	if ((ret = (p->pst->err == 0) ? 0 : -1) == 0)
+	  stbuf = p->pst->sb;
+	else
+	  errno = p->pst->err;
+	p->pst = NULL;
+  } else if (p->pfd >= 0)
+	ret = statnode(p->pfd, name + p->poff, &stbuf, atflag, p);
+  else
+	ret = statnode(AT_FDCWD, name, &stbuf, atflag, p);
+
+  if (ret < 0) {
 	warn("%s", name);
 	return (-1);
   }
@@ -206,6 +508,13 @@ nodestat(const char *name, plan_t *p,
   p->nstat->gid = stbuf.st_gid;
   p->nstat->uid = stbuf.st_uid;
   p->nstat->dev = stbuf.st_dev;
+  p->nstat->ino = stbuf.st_ino;
+  p->nstat->size = stbuf.st_size;
+  p->nstat->mtime = stbuf.st_mtime;
+  p->nstat->ctime = stbuf.st_ctime;
+  p->nstat->atime = stbuf.st_atime;
+  p->nstat->mode = stbuf.st_mode;
+  p->nstat->nlink = stbuf.st_nlink;
 
   if (S_ISBLK(stbuf.st_mode))
 	p->nstat->type = NT_ISBLK;
@@ -222,13 +531,16 @@ nodestat(const char *name, plan_t *p,
   if (S_ISSOCK(stbuf.st_mode))
 	p->nstat->type = NT_ISSOCK;
 
-  if (p->nstat->type != NT_ISDIR &&
+  /* opening every directory is only worth it for --empty. */
+  if (!(p->args->need_stat & NS_EMPTY)) {
+	p->nstat->empty = 0;
+  } else if (p->nstat->type != NT_ISDIR &&
       p->nstat->type == NT_ISREG) {
 	if (stbuf.st_size != 0)
 	  p->nstat->empty = 0;
   } else {
 	/* code from from BSD find(1) */
-	if ((dirp = opendir(name)) != NULL) {
+	if ((dirp = diropen(name, p)) != NULL) {
 	  for (dir = readdir(dirp); dir; dir = readdir(dirp))
 		if (dir->d_name[0] != '.' ||
 			(dir->d_name[1] != '\0' &&
@@ -248,108 +560,955 @@ nodestat(const char *name, plan_t *p,
   return (0);
 }
 
-static void
-walk_through(const char *name, plan_t *p)
+/*
+ * the last name of a path. unlike basename(3), it never writes to
+ * the path, which is the walker's own buffer. trailing slashes are
+ * taken off the roots beforehand.
+ */
+static __inline const char *
+nodename(const char *path)
 {
-  int retval;
-  char tmp_buf[MAXPATHLEN];
-  static struct dirent *dir;
-  static DIR *dirp;
-  struct dlist *paths;
-  plist_t *pl;
+  const char *s;
 
-  if (name == NULL ||
-	  p == NULL ||
-	  p->plans == NULL ||
-	  p->nstat == NULL)
-	return;
+  if ((s = strrchr(path, '/')) == NULL || s[1] == '\0')
+	return (path);
 
-  if ((paths = dl_init()) == NULL)
-	return;
+  return (s + 1);
+}
+
+static int
+pruned(const char *d_name, plan_t *p)
+{
+  prune_t *pr;
+
+  for (pr = p->args->prune; pr != NULL; pr = pr->next) {
+	if (pr->literal) {
+	  if (strcmp(pr->pattern, d_name) == 0)
+		return (1);
+	} else if (fnmatch(pr->pattern, d_name, 0) == 0) {
+	  return (1);
+	}
+  }
+
+  return (0);
+}
+
+/* FNV-1a of a path relative to its root, the same on every host */
+static unsigned int
+shard_of(const char *rel, unsigned int n)
+{
+  uint64_t h;
+
+  while (rel[0] == '/')
+	rel++;
+
+  for (h = 0xcbf29ce484222325ULL; *rel != '\0'; rel++)
+	h = (h ^ (unsigned char)*rel) * 0x100000001b3ULL;
+
+  return ((unsigned int)(h % n));
+}
+
+/* run a free filter, keeping the counts plan_reorder() goes by */
+static int
+filter(PLAN *pn, const char *name, plan_t *p, int timed)
+{
+  int ret;
+  struct timespec t0, t1;
+
+  if (!timed || clock_gettime(CLOCK_MONOTONIC, &t0) < 0) {
+	ret = pn->s_func(name, p);
+  } else {
+	ret = pn->s_func(name, p);
+	if (clock_gettime(CLOCK_MONOTONIC, &t1) == 0) {
+	  pn->ntimed++;
+	  pn->nsecs += (t1.tv_sec - t0.tv_sec) * 1000000000LL +
+		(t1.tv_nsec - t0.tv_nsec);
+	}
+  }
+
+  pn->ncalls++;
+  if (ret != 0)
+	pn->nfails++;
+
+  return (ret);
+}
+
+/*
+ * evaluate the plan on a node, return 1 if it is to be descended.
+ */
+static int
+visit(const char *name, plan_t *p, int depth)
+{
+  int retval, mine, timed;
+  plist_t *pl;
 
   retval = 0;
+
+  /*
+   * --shard: what is at the split depth or above belongs to the
+   * shard its path relative to the root hashes to, and what is below
+   * to the one of its ancestor at the split depth. a root, relative
+   * to which every path is empty, hashes as itself.
+   */
+  mine = (depth >= p->args->mindepth);
+  if (p->args->nshards > 1 && depth <= p->args->sharddepth &&
+	  shard_of(depth == 0 ? name : name + p->rootlen,
+			   p->args->nshards) != p->args->shard) {
+	if (depth == p->args->sharddepth)
+	  return (0);
+	mine = 0;
+  }
   
   pl = p->plans;
 
-  pl->cur = pl->start;
-  while (pl->cur != NULL) {
-
-	/* bypass s_path() */
-	if (pl->cur->exec == 1) {
-	  pl->retval = (retval |= pl->cur->s_func(name, p));
+  /* the common sets of filters have an evaluator of their own */
+  if (p->eval != NULL) {
+	pl->retval = retval = p->eval->fn(name, p, mine);
+  } else {
+	/* the free filters go by how soon they have rejected nodes */
+	if (mine && ++pl->nvisits % NREORDER == 0)
+	  plan_reorder(pl);
+	timed = (mine && pl->nvisits % NTIMED == 0);
+
+	pl->cur = pl->start;
+	while (pl->cur != NULL) {
+
+	  /* bypass s_path(), and the filters above --mindepth */
+	  if (pl->cur->exec == 2 ||
+		  (pl->cur->exec == 1 && mine)) {
+		/* those left would not change a rejection */
+		if (!pl->cur->free)
+		  pl->retval = (retval |= pl->cur->s_func(name, p));
+		else if (retval == 0)
+		  pl->retval = (retval |= filter(pl->cur, name, p, timed));
 #ifdef _DEBUG_
-	  warnx("%s: retval=%d", pl->cur->func_name, pl->retval);
+		warnx("%s: retval=%d", pl->cur->func_name, pl->retval);
 #endif
-	}
+	  }
 
-	if (pl->cur)
-	  pl->cur = pl->cur->next;
+	  if (pl->cur)
+		pl->cur = pl->cur->next;
+	}
   }
 
   if (p->args->need_xdev) {
-	if (retval != 0) {
-	  dl_free(paths);
-	  paths = NULL;
-	  return;
-	}
+	if (retval != 0)
+	  return (0);
   }
   
-  if (retval == 0) {
-	out(name);
+  if (retval == 0 && mine) {
+	out(name, p);
+	if (++p->nmatch == p->args->maxresults)
+	  p->stop = 1;
+  }
+
+  if (depth == 0)
+	p->rootdev = p->nstat->dev;
+
+  /* mount points of the file systems to skip, but not below a root */
+  if (p->nstat->type != NT_ISDIR ||
+	  (p->args->maxdepth >= 0 && depth >= p->args->maxdepth) ||
+	  (p->nstat->dev != p->rootdev &&
+	   (mount_flags(p->nstat->dev, p) & MT_SKIP))) {
+	/* nothing below it will be deleted first. */
+	if (p->deldir) {
+	  p->deldir = 0;
+	  delnode(name, NT_ISDIR, p);
+	}
+	return (0);
+  }
+
+  return (1);
+}
+
+/*
+ * append `name' to the first `len' bytes of the path being walked
+ * through, growing it as needed. returns the new length, 0 on error.
+ */
+static size_t
+pathcat(walk_t *w, size_t len, const char *name)
+{
+  size_t nlen, need;
+  char *tmp;
+
+  nlen = strlen(name);
+  need = len + nlen + 2;
+
+  if (need > w->size) {
+	while (need > w->size)
+	  w->size = (w->size == 0) ? MAXPATHLEN : w->size * 2;
+	if ((tmp = (char *)realloc(w->path, w->size)) == NULL) {
+	  warn("%s", name);
+	  return (0);
+	}
+	w->path = tmp;
   }
 
-  if (p->nstat->type != NT_ISDIR) {
-	dl_free(paths);
-	paths = NULL;
+  if (len > 0 && w->path[len - 1] != '/')
+	w->path[len++] = '/';
+  memcpy(w->path + len, name, nlen + 1);
+
+  return (len + nlen);
+}
+
+int
+arena_add(arena_t *ar, const char *name)
+{
+  size_t nlen;
+  char *tmp;
+  nrec_t *rtmp;
+
+  nlen = strlen(name) + 1;
+  if (ar->len + nlen > ar->size) {
+	while (ar->len + nlen > ar->size)
+	  ar->size = (ar->size == 0) ? 4096 : ar->size * 2;
+	if ((tmp = (char *)realloc(ar->buf, ar->size)) == NULL) {
+	  warn("%s", name);
+	  return (-1);
+	}
+	ar->buf = tmp;
+  }
+
+  if (ar->nrecs == ar->maxrecs) {
+	ar->maxrecs = (ar->maxrecs == 0) ? 256 : ar->maxrecs * 2;
+	if ((rtmp = (nrec_t *)realloc(ar->recs,
+								  ar->maxrecs * sizeof(nrec_t))) == NULL) {
+	  warn("%s", name);
+	  return (-1);
+	}
+	ar->recs = rtmp;
+  }
+
+  memcpy(ar->buf + ar->len, name, nlen);
+  ar->recs[ar->nrecs].off = ar->len;
+  ar->recs[ar->nrecs].len = nlen - 1;
+  ar->recs[ar->nrecs].flags = 0;
+  ar->recs[ar->nrecs].ino = 0;
+  ar->nrecs++;
+  ar->len += nlen;
+
+  return (0);
+}
+
+static int
+nrec_cmp(const char *buf, nrec_t *a, nrec_t *b, size_t d)
+{
+  return (strcmp(buf + a->off + d, buf + b->off + d));
+}
+
+/*
+ * MSD radix sort of the records on the bytes of their names,
+ * i.e. strcmp(3) order. LC_COLLATE is never set by search, so
+ * this is also the order dl_sort() gives. buckets are kept on a
+ * heap stack; short ones fall back to insertion sort.
+ */
+void
+arena_sort(arena_t *ar)
+{
+  int c;
+  size_t i, j, lo, n, d, sp, maxsp;
+  size_t count[257], pos[257];
+  nrec_t *r, *tmp, key;
+  struct { size_t lo, n, d; } *stack, *stmp;
+
+  if (ar->nrecs < 2)
+	return;
+
+  if ((tmp = (nrec_t *)malloc(ar->nrecs * sizeof(nrec_t))) == NULL ||
+	  (stack = malloc((maxsp = 64) * sizeof(*stack))) == NULL) {
+	free(tmp);
+	warn("sort");
 	return;
   }
-  
-  if (NULL == (dirp = opendir(name))) {
-	warn("%s", name);
-	dl_free(paths);
-	paths = NULL;
+
+  sp = 0;
+  stack[sp].lo = 0;
+  stack[sp].n = ar->nrecs;
+  stack[sp++].d = 0;
+
+  while (sp > 0) {
+	sp--;
+	lo = stack[sp].lo;
+	n = stack[sp].n;
+	d = stack[sp].d;
+	r = ar->recs + lo;
+
+	if (n < 32) {
+	  for (i = 1; i < n; i++) {
+		key = r[i];
+		for (j = i; j > 0 && nrec_cmp(ar->buf, &r[j - 1], &key, d) > 0; j--)
+		  r[j] = r[j - 1];
+		r[j] = key;
+	  }
+	  continue;
+	}
+
+	/* bucket 0 holds the names that end at d */
+	bzero(count, sizeof(count));
+	for (i = 0; i < n; i++) {
+	  c = (d < r[i].len) ? (unsigned char)ar->buf[r[i].off + d] + 1 : 0;
+	  count[c]++;
+	}
+
+	pos[0] = 0;
+	for (c = 1; c < 257; c++)
+	  pos[c] = pos[c - 1] + count[c - 1];
+
+	for (i = 0; i < n; i++) {
+	  c = (d < r[i].len) ? (unsigned char)ar->buf[r[i].off + d] + 1 : 0;
+	  tmp[pos[c]++] = r[i];
+	}
+	memcpy(r, tmp, n * sizeof(nrec_t));
+
+	for (i = count[0], c = 1; c < 257; i += count[c++]) {
+	  if (count[c] < 2)
+		continue;
+	  if (sp == maxsp) {
+		maxsp *= 2;
+		if ((stmp = realloc(stack, maxsp * sizeof(*stack))) == NULL) {
+		  warn("sort");
+		  goto out;
+		}
+		stack = stmp;
+	  }
+	  stack[sp].lo = lo + i;
+	  stack[sp].n = count[c];
+	  stack[sp++].d = d + 1;
+	}
+  }
+
+ out:
+  free(stack);
+  free(tmp);
+}
+
+static __inline size_t
+dset_hash(dev_t dev, ino_t ino, size_t size)
+{
+  uint64_t h;
+
+  h = ((uint64_t)ino ^ ((uint64_t)dev << 32 | (uint64_t)dev >> 32)) *
+	0x9e3779b97f4a7c15ULL;
+
+  return ((size_t)(h >> 32) & (size_t)(size - 1));
+}
+
+static dino_t *
+dset_find(dset_t *ds, dev_t dev, ino_t ino)
+{
+  size_t n;
+
+  if (ds->size == 0)
+	return (NULL);
+
+  for (n = dset_hash(dev, ino, ds->size); ds->tab[n].used;
+	   n = (n + 1) & (ds->size - 1)) {
+	if (ds->tab[n].dev == dev && ds->tab[n].ino == ino)
+	  return (&(ds->tab[n]));
+  }
+
+  return (NULL);
+}
+
+/* add (dev, ino), which must not be in the set yet */
+static dino_t *
+dset_add(dset_t *ds, dev_t dev, ino_t ino)
+{
+  size_t i, n, osize;
+  dino_t *otab, *e;
+
+  /* keep the load under 1/2, so probes stay short */
+  if ((ds->n + 1) * 2 > ds->size) {
+	otab = ds->tab;
+	osize = ds->size;
+	ds->size = (osize == 0) ? 256 : osize * 2;
+	if ((ds->tab = (dino_t *)calloc(ds->size, sizeof(dino_t))) == NULL) {
+	  ds->tab = otab;
+	  ds->size = osize;
+	  return (NULL);
+	}
+	for (i = 0; i < osize; i++) {
+	  if (!otab[i].used)
+		continue;
+	  for (n = dset_hash(otab[i].dev, otab[i].ino, ds->size);
+		   ds->tab[n].used; n = (n + 1) & (ds->size - 1))
+		;
+	  ds->tab[n] = otab[i];
+	}
+	free(otab);
+  }
+
+  for (n = dset_hash(dev, ino, ds->size); ds->tab[n].used;
+	   n = (n + 1) & (ds->size - 1))
+	;
+
+  e = &(ds->tab[n]);
+  e->used = 1;
+  e->dev = dev;
+  e->ino = ino;
+  e->onpath = 0;
+  ds->n++;
+
+  return (e);
+}
+
+/* linear probing allows deletion without tombstones */
+static void
+dset_del(dset_t *ds, dev_t dev, ino_t ino)
+{
+  size_t i, j, h;
+
+  if (ds->size == 0)
+	return;
+
+  for (i = dset_hash(dev, ino, ds->size); ds->tab[i].used;
+	   i = (i + 1) & (ds->size - 1)) {
+	if (ds->tab[i].dev == dev && ds->tab[i].ino == ino)
+	  break;
+  }
+  if (!ds->tab[i].used)
+	return;
+
+  /* move later entries of the cluster back into the hole */
+  for (j = (i + 1) & (ds->size - 1); ds->tab[j].used;
+	   j = (j + 1) & (ds->size - 1)) {
+	h = dset_hash(ds->tab[j].dev, ds->tab[j].ino, ds->size);
+	if (((j - h) & (ds->size - 1)) >= ((j - i) & (ds->size - 1))) {
+	  ds->tab[i] = ds->tab[j];
+	  i = j;
+	}
+  }
+  ds->tab[i].used = 0;
+  ds->n--;
+}
+
+/*
+ * with -L, a directory already on the way down is a loop, and one
+ * walked before, with --once, was reached through another link.
+ * returns 1 if `f' is not to be walked through.
+ */
+static int
+dset_check(frame_t *f, const char *path, plan_t *p)
+{
+  struct stat stbuf;
+  dino_t *e;
+
+  f->indset = 0;
+
+  if (fstat(dirfd(f->dirp), &stbuf) < 0)
+	return (0);
+
+  if ((e = dset_find(&(p->dirs), stbuf.st_dev, stbuf.st_ino)) != NULL) {
+	if (e->onpath)
+	  warnx("%s: file system loop detected", path);
+#ifdef _DEBUG_
+	else
+	  warnx("%s: already walked through", path);
+#endif
+	return (1);
+  }
+
+  if ((e = dset_add(&(p->dirs), stbuf.st_dev, stbuf.st_ino)) == NULL)
+	return (0);
+
+  e->onpath = 1;
+  f->dev = stbuf.st_dev;
+  f->ino = stbuf.st_ino;
+  f->indset = 1;
+
+  return (0);
+}
+
+static int
+nrec_inocmp(const void *a, const void *b)
+{
+  ino_t x = ((const nrec_t *)a)->ino, y = ((const nrec_t *)b)->ino;
+
+  return ((x > y) - (x < y));
+}
+
+/*
+ * --inode-order: look the children up in the order of their inode
+ * numbers, which roughly follows where their inodes are on disk,
+ * as fts(3) does. with -s, they are only stat'ed in that order, to
+ * have the inodes cached by the time they are visited by name.
+ */
+static void
+inode_order(frame_t *f, int prefetch)
+{
+  size_t i;
+  static struct stat stbuf;
+
+  qsort(f->names.recs, f->names.nrecs, sizeof(nrec_t), nrec_inocmp);
+
+  if (!prefetch)
 	return;
+
+  for (i = 0; i < f->names.nrecs; i++)
+	(void)fstatat(dirfd(f->dirp), f->names.buf + f->names.recs[i].off,
+				  &stbuf, AT_SYMLINK_NOFOLLOW);
+}
+
+/*
+ * read the directory w->path[0..len] into a new frame on top of
+ * the stack. only the names of the children are kept; with
+ * --stream, the children are visited right away and only the
+ * names of the directories to descend are kept.
+ */
+static int
+enter(walk_t *w, size_t len, int depth, unsigned int deldir, plan_t *p)
+{
+  int isdir, known;
+  size_t clen;
+  unsigned long nentries, nlisted, skip;
+  unsigned long long nvisit;
+  struct dirent *dir;
+  static struct stat stbuf;
+  struct timespec t0, tv0, tv1;
+  frame_t *f, **tmp;
+
+  if (w->top + 1 == w->max) {
+	w->max = (w->max == 0) ? 64 : w->max * 2;
+	if ((tmp = (frame_t **)realloc(w->stack,
+								   w->max * sizeof(frame_t *))) == NULL) {
+	  warn("%s", w->path);
+	  return (-1);
+	}
+	w->stack = tmp;
+	bzero(w->stack + w->top + 1, (w->max - w->top - 1) * sizeof(frame_t *));
+  }
+
+  if ((f = w->stack[w->top + 1]) == NULL) {
+	if ((f = (frame_t *)malloc(sizeof(frame_t))) == NULL) {
+	  warn("%s", w->path);
+	  return (-1);
+	}
+	bzero(f, sizeof(frame_t));
+	w->stack[w->top + 1] = f;
   }
+
+  f->names.len = f->names.nrecs = f->names.cur = 0;
+  f->npst = 0;
+  f->partial = 0;
+
+  if (p->args->need_stats)
+	(void)clock_gettime(CLOCK_MONOTONIC, &t0);
   
-  while (NULL != (dir = readdir(dirp))) {
+  if (NULL == (f->dirp = diropen(w->path, p))) {
+	warn("%s", w->path);
+	return (-1);
+  }
+
+  if (p->args->follow && dset_check(f, w->path, p)) {
+	closedir(f->dirp);
+	f->dirp = NULL;
+	return (1);
+  }
+
+  f->len = len;
+  f->depth = depth;
+  f->deldir = deldir;
+  f->ign = p->ignores;
+  if (p->args->need_ignore)
+	push_ignore(w->path, f->ifr, p);
+  
+  /*
+   * the children are known when resuming from --checkpoint with
+   * --stream, or when the directory is unchanged since --snapshot
+   * was taken.
+   */
+  f->reused = f->insnap = known = 0;
+  f->snap.len = f->snap.nrecs = 0;
+  skip = 0;
+  if (p->ckpt != NULL && p->ckpt->resuming)
+	known = ckpt_frame(f, &skip, p);
+  else if (p->snap != NULL && snap_lookup(f, p))
+	known = f->reused = 1;
+
+  nentries = nlisted = 0;
+  nvisit = 0;
+  while (!known && NULL != (dir = readdir(f->dirp))) {
+
+	/* a large directory is not to hold up a checkpoint or a stop */
+	if (ckpt_due && p->ckpt != NULL) {
+	  ckpt_part(w, f, nentries, p);
+	  if (p->stop)
+		break;
+	}
+
+	/* read before the checkpoint resumed from was saved */
+	if (nentries++ < skip)
+	  continue;
 	
 	if ((0 == strncmp(dir->d_name, ".", strlen(dir->d_name) + 1)) ||
 		(0 == strncmp(dir->d_name, "..", strlen(dir->d_name) + 1))) {
 	  continue;
 	}
+	nlisted++;
 
-	bzero(tmp_buf, MAXPATHLEN);
-	strlcpy(tmp_buf, name, MAXPATHLEN);
-	if ('/' != tmp_buf[strlen(tmp_buf) - 1])
-	  strlcat(tmp_buf, "/", MAXPATHLEN);
-	strlcat(tmp_buf, dir->d_name, MAXPATHLEN);
+	if (p->args->prune != NULL && pruned(dir->d_name, p))
+	  continue;
 
-	dl_append(tmp_buf, paths);
-  }
+	/* the repository itself is never walked, as by git(1) and rg(1) */
+	if (p->args->need_ignore && strcmp(dir->d_name, ".git") == 0)
+	  continue;
+
+	if (p->ignores != NULL || p->args->need_stream) {
+	  if ((clen = pathcat(w, len, dir->d_name)) == 0)
+		continue;
+	}
 
-  closedir(dirp);
+	if (p->ignores != NULL) {
+	  if (dir->d_type == DT_UNKNOWN)
+		isdir = (fstatat(dirfd(f->dirp), dir->d_name, &stbuf,
+						 AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(stbuf.st_mode));
+	  else
+		isdir = (dir->d_type == DT_DIR);
+	  if (ignored(w->path, clen, isdir, p))
+		continue;
+	}
+
+	if (p->args->need_stream) {
+	  p->pfd = dirfd(f->dirp);
+	  p->poff = clen - strlen(dir->d_name);
+	  if (p->args->need_stats)
+		(void)clock_gettime(CLOCK_MONOTONIC, &tv0);
+	  if (visit(w->path, p, depth + 1) &&
+		  arena_add(&(f->names), dir->d_name) == 0 && p->deldir)
+		f->names.recs[f->names.nrecs - 1].flags |= NR_RMDIR;
+	  p->deldir = 0;
+	  /* the time of the visit is not the directory's */
+	  if (p->args->need_stats &&
+		  clock_gettime(CLOCK_MONOTONIC, &tv1) == 0)
+		nvisit += (tv1.tv_sec - tv0.tv_sec) * 1000000000LL +
+		  (tv1.tv_nsec - tv0.tv_nsec);
+	  if (p->stop)
+		break;
+	  continue;
+	}
+
+	if (arena_add(&(f->names), dir->d_name) == 0)
+	  f->names.recs[f->names.nrecs - 1].ino = dir->d_ino;
+  }
+  w->path[len] = '\0';
+
+  /* with --stream, the children are visited already */
+  if (p->args->need_inosort && !p->args->need_stream && !known)
+	inode_order(f, p->args->need_sort);
+
+  if (p->args->need_stats)
+	devstat(f->dirp, nlisted, &t0, nvisit, p);
+
+  /*
+   * keep the fd limit in mind on deep trees, but hold on to a
+   * directory every so often so children can still be looked up
+   * relative to it without hitting MAXPATHLEN.
+   */
+  if (depth < NOPENDIRS ||
+	  w->top < 0 ||
+	  w->stack[w->top]->anchor < 0 ||
+	  len - w->stack[w->stack[w->top]->anchor]->len > MAXPATHLEN / 2) {
+	f->anchor = w->top + 1;
+  } else {
+	closedir(f->dirp);
+	f->dirp = NULL;
+	f->anchor = w->stack[w->top]->anchor;
+  }
   
-  if (p->args->need_sort) {
-	dl_sort(paths);
+  if (p->args->need_sort && !known)
+	arena_sort(&(f->names));
+
+  if (p->ckpt != NULL)
+	ckpt_seek(f, p);
+
+  w->top++;
+
+  return (0);
+}
+
+static void
+leave(walk_t *w, plan_t *p)
+{
+  int a;
+  dino_t *e;
+  frame_t *f;
+
+  f = w->stack[w->top--];
+
+  uring_drain(f);
+
+  if (f->dirp != NULL) {
+	closedir(f->dirp);
+	f->dirp = NULL;
   }
 
-  paths->cur = paths->head;
-  while (paths->cur != NULL) {
-	walk_through(paths->cur->ent, p);
-	if (paths->cur)
-	  paths->cur = paths->cur->next;
+  p->ignores = f->ign;
+
+  if (f->insnap && !p->stop)
+	snap_record(f, f->reused ? &(f->names) : &(f->snap), p);
+
+  if (f->indset) {
+	f->indset = 0;
+	if (!p->args->once)
+	  dset_del(&(p->dirs), f->dev, f->ino);
+	else if ((e = dset_find(&(p->dirs), f->dev, f->ino)) != NULL)
+	  e->onpath = 0;
   }
-  
-  dl_free(paths);
-  paths = NULL;
-  return;
+
+  /* post-order: whatever was to go below it is gone by now. */
+  if (f->deldir && !p->stop) {
+	w->path[f->len] = '\0';
+	if (w->top >= 0 && (a = w->stack[w->top]->anchor) >= 0)
+	  dislink(dirfd(w->stack[a]->dirp),
+			  w->path + w->stack[a]->len + (w->path[w->stack[a]->len] == '/'),
+			  w->path, NT_ISDIR, p);
+	else
+	  dislink(AT_FDCWD, w->path, w->path, NT_ISDIR, p);
+  }
+}
+
+/* keep a child of `f' for --snapshot if it matched or is a directory */
+static void
+snap_note(frame_t *f, const char *name, int hit, plan_t *p)
+{
+  unsigned int fl;
+
+  fl = (hit ? NR_HIT : 0) | ((p->nstat->type == NT_ISDIR) ? NR_DIR : 0);
+  if (fl != 0 && arena_add(&(f->snap), name) == 0)
+	f->snap.recs[f->snap.nrecs - 1].flags = fl;
+}
+
+/*
+ * put the stack saved by --checkpoint back, each directory read
+ * again and gone on with from where it was.
+ */
+static void
+resume(walk_t *w, plan_t *p)
+{
+  int a;
+  size_t len;
+  cframe_t *cf;
+  ckpt_t *ck;
+
+  ck = p->ckpt;
+  ck->resuming = 1;
+
+  for (ck->next = 0; ck->next < ck->nframes; ck->next++) {
+	cf = &(ck->frames[ck->next]);
+	if ((len = pathcat(w, 0, cf->path)) == 0)
+	  break;
+
+	if (w->top >= 0 && (a = w->stack[w->top]->anchor) >= 0) {
+	  p->pfd = dirfd(w->stack[a]->dirp);
+	  p->poff = w->stack[a]->len + (w->path[w->stack[a]->len] == '/');
+	} else {
+	  p->pfd = -1;
+	  p->poff = 0;
+	}
+
+	/* whatever was below it went with it */
+	if (enter(w, len, cf->depth, cf->deldir, p) != 0 || p->stop)
+	  break;
+  }
+
+  ck->resuming = 0;
+  ck->next = ck->nframes;
+}
+
+/*
+ * walk through the tree below `name' depth first, without
+ * recursion: the stack holds one frame per directory on the way
+ * down, each with the names of its children yet to be visited.
+ */
+static void
+walk_through(const char *name, plan_t *p)
+{
+  int i, descend;
+  size_t len;
+  unsigned int deldir, fl;
+  unsigned long nmatch;
+  const char *s;
+  struct stat stbuf;
+  frame_t *f, *a;
+  walk_t w;
+
+  if (name == NULL ||
+	  p == NULL ||
+	  p->plans == NULL ||
+	  p->nstat == NULL)
+	return;
+
+  bzero(&w, sizeof(walk_t));
+  w.top = -1;
+
+  p->pfd = -1;
+  p->poff = 0;
+  /* `d/' is walked through as `d', so that its name is `d' */
+  for (len = strlen(name); len > 1 && name[len - 1] == '/'; len--)
+	;
+  p->rootlen = len;
+
+  if (p->ckpt != NULL && p->ckpt->next < p->ckpt->nframes) {
+	/* the root is not visited again, but its device still counts */
+	if ((p->args->follow ? stat(name, &stbuf) : lstat(name, &stbuf)) == 0) {
+	  p->rootdev = stbuf.st_dev;
+	  if (p->args->odev == 0)
+		p->args->odev = stbuf.st_dev;
+	}
+	resume(&w, p);
+  } else if (pathcat(&w, 0, name) > 0) {
+	w.path[len = p->rootlen] = '\0';
+	if (visit(w.path, p, 0) && !p->stop) {
+	  deldir = p->deldir;
+	  p->deldir = 0;
+	  if (enter(&w, len, 0, deldir, p) < 0 && deldir)
+		delnode(w.path, NT_ISDIR, p);
+	}
+  }
+
+  while (w.top >= 0) {
+
+	if (ckpt_due && p->ckpt != NULL)
+	  ckpt_save(&w, p);
+	
+	f = w.stack[w.top];
+	if (p->stop) {
+	  leave(&w, p);
+	  continue;
+	}
+
+	if (f->names.cur == f->names.nrecs) {
+	  leave(&w, p);
+	  continue;
+	}
+	fl = f->names.recs[f->names.cur].flags;
+	deldir = fl & NR_RMDIR;
+	s = f->names.buf + f->names.recs[f->names.cur++].off;
+
+	if ((len = pathcat(&w, f->len, s)) == 0)
+	  continue;
+
+	/* a match kept by --snapshot, nothing to look at */
+	if (f->reused && !(fl & NR_DIR)) {
+	  out(w.path, p);
+	  if (++p->nmatch == p->args->maxresults)
+		p->stop = 1;
+	  continue;
+	}
+
+	if (f->anchor >= 0) {
+	  a = w.stack[f->anchor];
+	  p->pfd = dirfd(a->dirp);
+	  p->poff = a->len + (w.path[a->len] == '/');
+	} else {
+	  p->pfd = -1;
+	  p->poff = 0;
+	}
+
+	/* with --stream, subdirs were visited when read. */
+	if (!p->args->need_stream) {
+	  nmatch = p->nmatch;
+	  if (p->args->need_uring)
+		p->pst = uring_stat(f, f->names.cur - 1, p);
+	  descend = visit(w.path, p, f->depth + 1);
+	  p->pst = NULL;
+	  if (f->insnap && !f->reused)
+		snap_note(f, s, nmatch != p->nmatch, p);
+	  if (!descend)
+		continue;
+	  deldir = p->deldir;
+	  p->deldir = 0;
+	}
+	if (!p->stop &&
+		enter(&w, len, f->depth + 1, deldir, p) < 0 && deldir)
+	  delnode(w.path, NT_ISDIR, p);
+  }
+
+  p->pfd = -1;
+  p->poff = 0;
+
+  for (i = 0; i < w.max; i++) {
+	if (w.stack[i] != NULL) {
+	  uring_drain(w.stack[i]);
+	  free(w.stack[i]->names.buf);
+	  free(w.stack[i]->names.recs);
+	  free(w.stack[i]->snap.buf);
+	  free(w.stack[i]->snap.recs);
+	  free(w.stack[i]->pst);
+	}
+	free(w.stack[i]);
+  }
+  free(w.stack);
+  free(w.path);
+}
+
+/*
+ * --files-from: visit every path of the list as a root of its own,
+ * without descending into it. the list is read in large blocks, as
+ * it is typically a pipe from another tool.
+ */
+static void
+list_through(const char *file, plan_t *p)
+{
+  int delim;
+  ssize_t len;
+  size_t size;
+  char *line;
+  FILE *fp;
+
+  if (file == NULL || p == NULL)
+	return;
+
+  if (strcmp(file, "-") == 0)
+	fp = stdin;
+  else if ((fp = fopen(file, "r")) == NULL) {
+	warn("%s", file);
+	p->nfailed++;
+	return;
+  }
+  (void)setvbuf(fp, NULL, _IOFBF, LISTBUF);
+
+  delim = p->args->null ? '\0' : '\n';
+  line = NULL;
+  size = 0;
+
+  /* hashed as a whole by --shard */
+  p->rootlen = 0;
+  p->pfd = -1;
+  p->poff = 0;
+
+  while (!p->stop && (len = getdelim(&line, &size, delim, fp)) > 0) {
+	if (line[len - 1] == delim)
+	  line[--len] = '\0';
+	while (len > 1 && line[len - 1] == '/')
+	  line[--len] = '\0';
+	if (len == 0)
+	  continue;
+
+	(void)visit(line, p, 0);
+	/* nothing was read below it, so it goes now if empty */
+	if (p->deldir) {
+	  p->deldir = 0;
+	  delnode(line, NT_ISDIR, p);
+	}
+  }
+
+  if (ferror(fp)) {
+	warn("%s", file);
+	p->nfailed++;
+  }
+
+  free(line);
+  if (fp != stdin)
+	fclose(fp);
 }
 
 int
 s_regex(const char *name, plan_t *p)
 {
   int ret, plen, matched;
-  static char *pattern, *d_name, msg[LINE_MAX];
+  static char *pattern, msg[LINE_MAX];
+  static const char *d_name;
   static regex_t *fmt;
   static regmatch_t pmatch;
 
@@ -362,8 +1521,7 @@ s_regex(const char *name, plan_t *p)
   if (regexcomp(p->mt) < 0)
 	return (-1);
 
-  if ((d_name = basename(name)) == NULL)
-	return (-1);
+  d_name = nodename(name);
  
   fmt = &(p->mt->fmt);
   pattern = p->mt->pattern;
@@ -406,7 +1564,8 @@ s_name(const char *name, plan_t *p)
 {
   int matched;
   unsigned int plen, mflag;
-  char *pattern, *d_name;
+  char *pattern;
+  const char *d_name;
 
   if (name == NULL)
 	return (-1);
@@ -415,8 +1574,7 @@ s_name(const char *name, plan_t *p)
   if (p->mt == NULL)
 	return (-1);
 
-  if ((d_name = basename(name)) == NULL)
-	return (-1);
+  d_name = nodename(name);
   
   mflag = 0;
   pattern = p->mt->pattern;
@@ -453,7 +1611,7 @@ s_stat(const char *name, plan_t *p)
   if (p == NULL)
 	return (-1);
 
-  return (nodestat(name, p, &stat));
+  return (nodestat(name, p, 0));
 }
 
 int
@@ -464,16 +1622,13 @@ s_lstat(const char *name, plan_t *p)
   if (p == NULL)
 	return (-1);
 
-  return (nodestat(name, p, &lstat));
+  return (nodestat(name, p, AT_SYMLINK_NOFOLLOW));
 }
 
+/* the group was looked up by group_arg() in search.c */
 int
 s_gid(const char *name __unused, plan_t *p)
 {
-  gid_t id;
-  char *s;
-  static struct group *grp;
-
   if (p == NULL)
 	return (-1);
   if (p->args == NULL)
@@ -481,48 +1636,21 @@ s_gid(const char *name __unused, plan_t *p)
   if (p->nstat == NULL)
 	return (-1);
 
-  id = strtol(p->args->sgid, &s, 0);
-  if (s[0] == '\0')
-	grp = getgrgid(id);
-  else
-	grp = getgrnam(s);
-  
-  if (grp == NULL) {
-	errx(EX_NOUSER, "--group: %s: no such group", p->args->sgid);
-  } else if (grp->gr_gid != p->nstat->gid) {
-	return (-1);
-  }
-  
-  return (0);
+  return (p->nstat->gid == p->args->gid ? (0) : (-1));
 }
 
+/* as s_gid(), by user_arg() */
 int
 s_uid(const char *name __unused, plan_t *p)
 {
-  uid_t id;
-  char *s;
-  static struct passwd *pwd;
-
   if (p == NULL)
 	return (-1);
   if (p->args == NULL)
 	return (-1);
   if (p->nstat == NULL)
 	return (-1);
-  
-  id = strtol(p->args->suid, &s, 0);
-  if (s[0] == '\0')
-	pwd = getpwuid(id);
-  else
-	pwd = getpwnam(s);
-  
-  if (pwd == NULL) {
-	errx(EX_NOUSER, "--user: %s: no such user", p->args->suid);
-  } else if (pwd->pw_uid != p->nstat->uid) {
-	return (-1);
-  }
-  
-  return (0);
+
+  return (p->nstat->uid == p->args->uid ? (0) : (-1));
 }
 
 int
@@ -553,7 +1681,7 @@ s_xdev(const char *name, plan_t *p)
 	p->args->odev = p->nstat->dev;
   if (p->nstat->dev != p->args->odev) {
 	if (p->nstat->type == NT_ISDIR) {
-	  out(name);
+	  out(name, p);
 	}
 	return (-1);
   }
@@ -592,21 +1720,41 @@ s_delete(const char *name, plan_t *p)
 	return (-1);
   }
 
+  /* directories go once walk_through() is done with them. */
   if (p->nstat->type == NT_ISDIR) {
-	dl_append(name, p->rdirs);
+	p->deldir = 1;
 #ifdef _DEBUG_	
 	warnx("directory: `%s' to be deleted", name);
 #endif	
   } else {
-    dl_append(name, p->rfiles);
-#ifdef _DEBUG_	
-	warnx("file: `%s' to be deleted", name);
-#endif	
+	delnode(name, NT_UNKNOWN, p);
   }
   /* upon -1, the results will not be printed out */
   return (-1);
 }
 
+int
+s_exec(const char *name, plan_t *p)
+{
+  if (name == NULL)
+	return (-1);
+  if (p == NULL)
+	return (-1);
+  if (p->plans == NULL)
+	return (-1);
+
+  if (p->plans->retval != 0) {
+	return (-1);
+  }
+
+  exec_add(name, p);
+  if (++p->nmatch == p->args->maxresults)
+	p->stop = 1;
+
+  /* the command takes the place of printing it out */
+  return (-1);
+}
+
 int
 s_path(const char *name __unused, plan_t *p)
 {  
@@ -615,50 +1763,59 @@ s_path(const char *name __unused, plan_t *p)
   }
   
   if (p->paths == NULL ||
-	  dl_empty(p->paths))
+	  (dl_empty(p->paths) && p->args->filesfrom == NULL))
 	return (-1);
  
+  /* without io_uring, everything is looked up as before */
+  if (p->args->need_uring && init_uring(p) < 0)
+	p->args->need_uring = 0;
+
   p->paths->cur = p->paths->head; 
+  p->root = 0;
   while (p->paths->cur != NULL) {
 #ifdef _DEBUG_
 	warnx("walking through: %s", p->paths->cur->ent);
 #endif
-	walk_through(p->paths->cur->ent, p);
+	/* those before the checkpoint are done */
+	if (p->ckpt == NULL || p->root >= p->ckpt->root)
+	  walk_through(p->paths->cur->ent, p);
+	if (p->stop)
+	  break;
 	if (p->paths->cur)
 	  p->paths->cur = p->paths->cur->next;
+	p->root++;
   }
+
+  if (p->args->filesfrom != NULL && !p->stop)
+	list_through(p->args->filesfrom, p);
+
+  if (p->args->need_gsort && gsort_finish(p) < 0)
+	p->nfailed++;
+  dupe_finish(p);
+
+  exec_finish(p);
+  snap_finish(p);
+  ckpt_finish(p);
   
- /*  --- delete files ---
-  *  must be here. because we have to wait for
-  *  walk_through() to terminate.
-  */
-  if (p->rfiles && !dl_empty(p->rfiles)) {
-	p->rfiles->cur = p->rfiles->head;
-	while (p->rfiles->cur != NULL) {
-#ifdef _DEBUG_
-	  warnx("%s deleted!", p->rfiles->cur->ent);
-#endif
-	  /* to delete files, we have no need to specify its file type */
-	  dislink(p->rfiles->cur->ent, NT_UNKNOWN);
-	  if (p->rfiles->cur)
-		p->rfiles->cur = p->rfiles->cur->next;
-	}
-  }
+  if (p->args->need_stats)
+	stats(p);
 
-  /* delete dirs */
-  if (p->rdirs) {
-	p->rdirs->cur = p->rdirs->head;
-	while (p->rdirs->cur != NULL) {
-#ifdef _DEBUG_		
-	  warnx("%s deleted!", p->rdirs->cur->ent);
-#endif
-	  dislink(p->rdirs->cur->ent, NT_ISDIR);
-	  if (p->rdirs->cur)
-		p->rdirs->cur = p->rdirs->cur->next;
-	}
-  }
+  free(p->dirs.tab);
+  bzero(&(p->dirs), sizeof(dset_t));
+  free(p->devs);
+  p->devs = NULL;
+  p->ndevs = 0;
+  free_mounts(&(p->mounts));
 
-  return (0);
+  /* interrupted, to be resumed */
+  if (p->ckpt != NULL && p->ckpt->stopped)
+	return (1);
+
+  /* tell whether anything was found when asked to stop early */
+  if (p->args->maxresults > 0 && p->nmatch == 0)
+	return (1);
+
+  return ((p->nfailed > 0) ? (1) : (0));
 }
 
 int
@@ -675,6 +1832,81 @@ s_type(const char *s __unused, plan_t *p)
   return ((p->args->type == p->nstat->type) ? (0) : (-1));
 }
 
+int
+s_size(const char *name __unused, plan_t *p)
+{
+  if (p == NULL ||
+	  p->args == NULL ||
+	  p->nstat == NULL)
+	return (-1);
+
+  return (INRANGE(p->nstat->size, p->args->size) ? (0) : (-1));
+}
+
+int
+s_time(const char *name __unused, plan_t *p)
+{
+  if (p == NULL ||
+	  p->args == NULL ||
+	  p->nstat == NULL)
+	return (-1);
+
+  if ((p->args->need_time & NS_MTIME) &&
+	  !INRANGE(p->nstat->mtime, p->args->mtime))
+	return (-1);
+  if ((p->args->need_time & NS_CTIME) &&
+	  !INRANGE(p->nstat->ctime, p->args->ctime))
+	return (-1);
+  if ((p->args->need_time & NS_ATIME) &&
+	  !INRANGE(p->nstat->atime, p->args->atime))
+	return (-1);
+
+  return (0);
+}
+
+int
+s_perm(const char *name __unused, plan_t *p)
+{
+  mode_t mode;
+
+  if (p == NULL ||
+	  p->args == NULL ||
+	  p->nstat == NULL)
+	return (-1);
+
+  mode = p->nstat->mode & 07777;
+
+  switch (p->args->permop) {
+  case '-':
+	return (((mode & p->args->perm) == p->args->perm) ? (0) : (-1));
+  case '/':
+	return (((mode & p->args->perm) != 0 || p->args->perm == 0) ?
+			(0) : (-1));
+  default:
+	return ((mode == p->args->perm) ? (0) : (-1));
+  }
+}
+
+int
+s_links(const char *name __unused, plan_t *p)
+{
+  if (p == NULL ||
+	  p->args == NULL ||
+	  p->nstat == NULL)
+	return (-1);
+
+  return (INRANGE(p->nstat->nlink, p->args->links) ? (0) : (-1));
+}
+
+int
+s_fstype(const char *name __unused, plan_t *p)
+{
+  if (p == NULL ||
+	  p->nstat == NULL)
+	return (-1);
+
+  return ((mount_flags(p->nstat->dev, p) & MT_MATCH) ? (0) : (-1));
+}
 
 int
 s_nogroup(const char *name __unused, plan_t *p)
@@ -728,10 +1960,20 @@ s_usage(const char *s __unused, plan_t *p __unused)
  [-n|--name ...]\
  [-r|--regex ...]\
  [-t|--type ...]\
- [...]\n";
+ [...]\n\
+ \t[--maxdepth n] [--mindepth n] [--prune pattern ...] [--ignore-files]\n\
+ \t[--stream] [--nosync] [--max-results n | --quit]\n\
+ \t[--global-sort [--sort-memory size]] [--stats]\n\
+ \t[--printf format | --json-lines] [--once]\n\
+ \t[--fstype type ...] [--skip-fstype type ...] [--inode-order]\n\
+ \t[--snapshot file] [--checkpoint file | --resume file]\n\
+ \t[--shard i/n [--shard-depth n]] [--files-from file [-0]]\n\
+ \t[--duplicates] [--io-uring]\n\
+ \t[-j n] [--exec command ... [{}] ... ; | --exec command ... {} +]\n\
+ \t%s --merge file ...\n";
 
   (void)fprintf(stderr,	usage,
-				SEARCH_NAME, SEARCH_NAME);
+				SEARCH_NAME, SEARCH_NAME, SEARCH_NAME);
   return (0);
 }
 
@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2005-2010 Denise H. G. <darcsis@gmail.com>
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * --global-sort: results are gathered into sorted runs of at most
+ * --sort-memory bytes, spilled to temporary files as length
+ * prefixed records and merged back to stdout at the end.
+ */
+
+#include "search.h"
+
+/* runs merged at once, bounding the open files */
+#define NMERGE 64
+
+extern int  arena_add(arena_t *, const char *);
+extern void arena_sort(arena_t *);
+
+static FILE *run_open(void);
+static int  run_spill(gsort_t *);
+static int  run_next(run_t *);
+static int  run_less(run_t *, run_t *);
+static int  run_merge(run_t *, unsigned int, FILE *, const char *);
+static void run_free(run_t *);
+static size_t run_room(arena_t *, size_t);
+
+int  gsort_add(const char *, plan_t *);
+int  gsort_finish(plan_t *);
+int  gsort_merge(int, char **);
+void free_gsort(gsort_t **);
+
+static FILE *
+run_open(void)
+{
+  int fd;
+  char tmpl[MAXPATHLEN];
+  const char *dir;
+  FILE *fp;
+
+  if ((dir = getenv("TMPDIR")) == NULL || dir[0] == '\0')
+	dir = "/tmp";
+
+  snprintf(tmpl, MAXPATHLEN, "%s/%s.XXXXXXXX", dir, SEARCH_NAME);
+  if ((fd = mkstemp(tmpl)) < 0) {
+	warn("%s", tmpl);
+	return (NULL);
+  }
+  (void)unlink(tmpl);
+
+  if ((fp = fdopen(fd, "w+")) == NULL) {
+	warn("%s", tmpl);
+	close(fd);
+  }
+
+  return (fp);
+}
+
+/*
+ * sort what is in memory and write it out as a new run. when
+ * NMERGE runs are pending, they are merged into a single one.
+ */
+static int
+run_spill(gsort_t *gs)
+{
+  size_t i;
+  uint32_t len;
+  nrec_t *r;
+  FILE *fp;
+
+  if ((fp = run_open()) == NULL)
+	return (-1);
+
+  arena_sort(&(gs->recs));
+
+  for (i = 0; i < gs->recs.nrecs; i++) {
+	r = &(gs->recs.recs[i]);
+	len = (uint32_t)r->len;
+	if (fwrite(&len, sizeof(len), 1, fp) != 1 ||
+		fwrite(gs->recs.buf + r->off, 1, r->len, fp) != r->len) {
+	  warn("--global-sort");
+	  fclose(fp);
+	  return (-1);
+	}
+  }
+
+  /* rewind(3) would flush it, and throw away a failure */
+  if (fflush(fp) != 0 || ferror(fp)) {
+	warn("--global-sort");
+	fclose(fp);
+	return (-1);
+  }
+
+  gs->recs.len = gs->recs.nrecs = 0;
+
+  if (gs->nruns == NMERGE) {
+	rewind(fp);
+	gs->runs[gs->nruns].fp = fp;
+	gs->runs[gs->nruns].buf = NULL;
+	gs->runs[gs->nruns].size = 0;
+	if ((fp = run_open()) == NULL)
+	  return (-1);
+	if (run_merge(gs->runs, NMERGE + 1, fp, NULL) < 0) {
+	  fclose(fp);
+	  return (-1);
+	}
+	gs->nruns = 0;
+  }
+
+  rewind(fp);
+  gs->runs[gs->nruns].fp = fp;
+  gs->runs[gs->nruns].buf = NULL;
+  gs->runs[gs->nruns].size = 0;
+  gs->nruns++;
+
+  return (0);
+}
+
+/* read the next record of a run, 0 at the end of it */
+static int
+run_next(run_t *r)
+{
+  ssize_t n;
+  uint32_t len;
+  char *tmp;
+
+  if (r->fp == NULL)
+	return (0);
+
+  if (r->text) {
+	if ((n = getline(&(r->buf), &(r->size), r->fp)) < 0)
+	  return (0);
+	if (n > 0 && r->buf[n - 1] == '\n')
+	  r->buf[--n] = '\0';
+	r->len = n;
+	return (1);
+  }
+
+  if (fread(&len, sizeof(len), 1, r->fp) != 1)
+	return (0);
+
+  if (len + 1 > r->size) {
+	r->size = len + 1;
+	if ((tmp = (char *)realloc(r->buf, r->size)) == NULL) {
+	  warn("--global-sort");
+	  return (0);
+	}
+	r->buf = tmp;
+  }
+
+  if (fread(r->buf, 1, len, r->fp) != len)
+	return (0);
+
+  r->buf[len] = '\0';
+  r->len = len;
+
+  return (1);
+}
+
+static int
+run_less(run_t *a, run_t *b)
+{
+  int ret;
+
+  ret = memcmp(a->buf, b->buf, (a->len < b->len) ? a->len : b->len);
+  if (ret == 0)
+	return (a->len < b->len);
+
+  return (ret < 0);
+}
+
+/*
+ * k-way merge of the runs through a binary heap, either into a new
+ * run or, when `eol' is given, as text ended by it. the runs are
+ * closed afterwards.
+ */
+static int
+run_merge(run_t *runs, unsigned int n, FILE *dst, const char *eol)
+{
+  int ret;
+  unsigned int i, j, k, size;
+  uint32_t len;
+  run_t **heap, *tmp;
+
+  if ((heap = (run_t **)malloc(n * sizeof(run_t *))) == NULL) {
+	warn("--global-sort");
+	return (-1);
+  }
+
+  size = 0;
+  for (i = 0; i < n; i++) {
+	if (!run_next(&runs[i]))
+	  continue;
+	/* sift up */
+	for (j = size++; j > 0 && run_less(&runs[i], heap[(j - 1) / 2]);
+		 j = (j - 1) / 2)
+	  heap[j] = heap[(j - 1) / 2];
+	heap[j] = &runs[i];
+  }
+
+  ret = 0;
+  while (size > 0) {
+	tmp = heap[0];
+	if (eol == NULL) {
+	  len = (uint32_t)tmp->len;
+	  if (fwrite(&len, sizeof(len), 1, dst) != 1 ||
+		  fwrite(tmp->buf, 1, tmp->len, dst) != tmp->len)
+		ret = -1;
+	} else {
+	  if (fwrite(tmp->buf, 1, tmp->len, dst) != tmp->len ||
+		  fputs(eol, dst) == EOF)
+		ret = -1;
+	}
+	if (ret < 0) {
+	  warn("--global-sort");
+	  break;
+	}
+
+	if (!run_next(tmp))
+	  tmp = heap[--size];
+
+	/* sift down */
+	for (j = 0; (k = 2 * j + 1) < size; j = k) {
+	  if (k + 1 < size && run_less(heap[k + 1], heap[k]))
+		k++;
+	  if (!run_less(heap[k], tmp))
+		break;
+	  heap[j] = heap[k];
+	}
+	if (size > 0)
+	  heap[j] = tmp;
+  }
+
+  free(heap);
+  for (i = 0; i < n; i++)
+	run_free(&runs[i]);
+
+  /* a short run would be merged on as if complete */
+  if (ret == 0 && (fflush(dst) != 0 || ferror(dst))) {
+	warn("--global-sort");
+	ret = -1;
+  }
+
+  return (ret);
+}
+
+static void
+run_free(run_t *r)
+{
+  if (r->fp != NULL) {
+	fclose(r->fp);
+	r->fp = NULL;
+  }
+  free(r->buf);
+  r->buf = NULL;
+  r->size = 0;
+}
+
+/*
+ * the memory the arena holds once `nlen' more bytes are in, growing
+ * as arena_add() does, so that --sort-memory bounds what is
+ * allocated rather than what is used of it.
+ */
+static size_t
+run_room(arena_t *ar, size_t nlen)
+{
+  size_t size, maxrecs;
+
+  size = ar->size;
+  while (ar->len + nlen > size)
+	size = (size == 0) ? 4096 : size * 2;
+
+  maxrecs = ar->maxrecs;
+  if (ar->nrecs == maxrecs)
+	maxrecs = (maxrecs == 0) ? 256 : maxrecs * 2;
+
+  return (size + maxrecs * sizeof(nrec_t));
+}
+
+int
+gsort_add(const char *name, plan_t *p)
+{
+  gsort_t *gs;
+
+  if (name == NULL || p == NULL)
+	return (-1);
+
+  if ((gs = p->gsort) == NULL) {
+	if ((gs = (gsort_t *)malloc(sizeof(gsort_t))) == NULL) {
+	  warn("--global-sort");
+	  return (-1);
+	}
+	bzero(gs, sizeof(gsort_t));
+	if ((gs->runs = (run_t *)calloc(NMERGE + 1, sizeof(run_t))) == NULL) {
+	  warn("--global-sort");
+	  free(gs);
+	  return (-1);
+	}
+	p->gsort = gs;
+  }
+
+  /* a failed spill loses results, the rest would be incomplete */
+  if (gs->failed)
+	return (-1);
+
+  if (gs->recs.nrecs > 0 &&
+	  run_room(&(gs->recs), strlen(name) + 1) > p->args->sortmem &&
+	  run_spill(gs) < 0) {
+	gs->failed = 1;
+	return (-1);
+  }
+
+  if (arena_add(&(gs->recs), name) < 0) {
+	gs->failed = 1;
+	return (-1);
+  }
+
+  return (0);
+}
+
+int
+gsort_finish(plan_t *p)
+{
+  size_t i;
+  const char *eol;
+  gsort_t *gs;
+
+  if (p == NULL || (gs = p->gsort) == NULL)
+	return (0);
+
+  if (gs->failed)
+	return (-1);
+
+  /* --printf records carry their own line ends */
+  eol = (p->fmt != NULL) ? "" : "\n";
+
+  /* everything fit in memory */
+  if (gs->nruns == 0) {
+	arena_sort(&(gs->recs));
+	for (i = 0; i < gs->recs.nrecs; i++)
+	  (void)fprintf(stdout, "%s%s", gs->recs.buf + gs->recs.recs[i].off, eol);
+	return (0);
+  }
+
+  if (gs->recs.nrecs > 0 && run_spill(gs) < 0)
+	return (-1);
+
+  /* the memory of the last run is not needed any more */
+  free(gs->recs.buf);
+  free(gs->recs.recs);
+  bzero(&(gs->recs), sizeof(arena_t));
+
+  if (run_merge(gs->runs, gs->nruns, stdout, eol) < 0)
+	return (-1);
+  gs->nruns = 0;
+
+  return (0);
+}
+
+/*
+ * --merge: the files, each sorted as by --global-sort, as one
+ * sorted output. `-' is the standard input.
+ */
+int
+gsort_merge(int argc, char **argv)
+{
+  int i, ret;
+  run_t *runs;
+
+  if (argc == 0)
+	return (0);
+
+  if ((runs = (run_t *)calloc(argc, sizeof(run_t))) == NULL) {
+	warn("--merge");
+	return (1);
+  }
+
+  ret = 0;
+  for (i = 0; i < argc; i++) {
+	runs[i].text = 1;
+	if (strcmp(argv[i], "-") == 0)
+	  runs[i].fp = stdin;
+	else if ((runs[i].fp = fopen(argv[i], "r")) == NULL) {
+	  warn("%s", argv[i]);
+	  ret = 1;
+	}
+  }
+
+  if (run_merge(runs, argc, stdout, "\n") < 0)
+	ret = 1;
+
+  free(runs);
+  return (ret);
+}
+
+void
+free_gsort(gsort_t **gsort)
+{
+  unsigned int i;
+  gsort_t *gs = *gsort;
+
+  if (gs == NULL)
+	return;
+
+  for (i = 0; i < gs->nruns; i++)
+	run_free(&(gs->runs[i]));
+  free(gs->runs);
+  free(gs->recs.buf);
+  free(gs->recs.recs);
+  free(gs);
+  *gsort = NULL;
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2005-2010 Denise H. G. <darcsis@gmail.com>
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * --ignore-files: .gitignore, .ignore, .git/info/exclude and the
+ * global git excludes file, matched like git(1) does.
+ */
+
+#include "search.h"
+
+#define NBUCKETS 256
+
+/*
+ * in order of increasing precedence. the first one only counts at
+ * the top of a repository, where .git is a directory.
+ */
+static const char *ignfiles[] = {
+  ".git/info/exclude",
+  ".gitignore",
+  ".ignore",
+  NULL
+};
+
+/*
+ * the same file is met again through the links of -L, under more
+ * than one starting point, and as the global one of every root.
+ */
+static ignore_t *cache[NBUCKETS];
+static ignore_t *global;
+static int global_loaded;
+
+static int  ign_rule(char *, irule_t *);
+static ignore_t *ign_load(const char *);
+static int  ign_match(const char *, char *);
+
+int  push_ignore(const char *, istack_t *, plan_t *);
+int  ignored(const char *, size_t, int, plan_t *);
+void free_ignore(void);
+
+static int
+ign_rule(char *line, irule_t *r)
+{
+  size_t len;
+
+  len = strlen(line);
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+	line[--len] = '\0';
+  /* trailing spaces are ignored unless quoted with a backslash */
+  while (len > 1 && line[len - 1] == ' ' && line[len - 2] != '\\')
+	line[--len] = '\0';
+
+  if (len == 0 || line[0] == '#')
+	return (-1);
+
+  r->negate = r->dironly = r->anchored = r->dstar = 0;
+
+  if (line[0] == '!') {
+	r->negate = 1;
+	line++;
+	len--;
+  } else if (line[0] == '\\' && (line[1] == '#' || line[1] == '!')) {
+	line++;
+	len--;
+  }
+
+  if (len > 0 && line[len - 1] == '/') {
+	r->dironly = 1;
+	line[--len] = '\0';
+  }
+
+  if (strncmp(line, "**/", 3) == 0 && strchr(line + 3, '/') == NULL) {
+	line += 3;
+  } else if (strchr(line, '/') != NULL) {
+	r->anchored = 1;
+	if (line[0] == '/')
+	  line++;
+  }
+
+  if (line[0] == '\0')
+	return (-1);
+
+  /* `**' only means anything as a whole component of a path */
+  if (r->anchored &&
+	  (strncmp(line, "**/", 3) == 0 || strstr(line, "/**/") != NULL ||
+	   ((len = strlen(line)) >= 3 && strcmp(line + len - 3, "/**") == 0)))
+	r->dstar = 1;
+
+  if ((r->pattern = strdup(line)) == NULL)
+	return (-1);
+
+  return (0);
+}
+
+static ignore_t *
+ign_load(const char *path)
+{
+  unsigned int n, max;
+  char line[LINE_MAX];
+  struct stat stbuf;
+  ignore_t *ign;
+  irule_t *rules;
+  FILE *fp;
+
+  if (stat(path, &stbuf) < 0 || !S_ISREG(stbuf.st_mode))
+	return (NULL);
+
+  n = (unsigned int)(stbuf.st_ino ^ stbuf.st_dev) % NBUCKETS;
+  for (ign = cache[n]; ign != NULL; ign = ign->next) {
+	if (ign->dev == stbuf.st_dev &&
+		ign->ino == stbuf.st_ino &&
+		ign->mtime == stbuf.st_mtime) {
+#ifdef _DEBUG_
+	  warnx("%s: cached ignore rules", path);
+#endif
+	  return (ign);
+	}
+  }
+
+  if ((fp = fopen(path, "r")) == NULL) {
+	warn("%s", path);
+	return (NULL);
+  }
+
+  if ((ign = (ignore_t *)malloc(sizeof(ignore_t))) == NULL) {
+	fclose(fp);
+	return (NULL);
+  }
+
+  ign->dev = stbuf.st_dev;
+  ign->ino = stbuf.st_ino;
+  ign->mtime = stbuf.st_mtime;
+  ign->size = max = 0;
+  ign->rules = NULL;
+
+  while (fgets(line, LINE_MAX, fp) != NULL) {
+	if (ign->size == max) {
+	  max = (max == 0) ? 16 : max * 2;
+	  if ((rules = realloc(ign->rules, max * sizeof(irule_t))) == NULL)
+		break;
+	  ign->rules = rules;
+	}
+	if (ign_rule(line, &(ign->rules[ign->size])) == 0)
+	  ign->size++;
+  }
+
+  fclose(fp);
+
+#ifdef _DEBUG_
+  warnx("%s: %u ignore rule(s)", path, ign->size);
+#endif
+
+  ign->next = cache[n];
+  cache[n] = ign;
+
+  return (ign);
+}
+
+/*
+ * fnmatch(3) with FNM_PATHNAME, where a `**' component stands for any
+ * number of directories, none included, and a trailing one for
+ * everything inside, as in gitignore(5). `path' is written to and
+ * restored.
+ */
+static int
+ign_match(const char *pat, char *path)
+{
+  int ret;
+  size_t n;
+  const char *s;
+  char *t, head[MAXPATHLEN];
+
+  if (strcmp(pat, "**") == 0)
+	return (path[0] != '\0' ? (0) : (FNM_NOMATCH));
+
+  if (strncmp(pat, "**/", 3) == 0) {
+	for (t = path; ; t++) {
+	  if (ign_match(pat + 3, t) == 0)
+		return (0);
+	  if ((t = strchr(t, '/')) == NULL)
+		return (FNM_NOMATCH);
+	}
+  }
+
+  for (s = pat; (s = strstr(s, "/**")) != NULL; s += 3) {
+	if (s[3] == '/' || s[3] == '\0')
+	  break;
+  }
+  if (s == NULL)
+	return (fnmatch(pat, path, FNM_PATHNAME));
+
+  /* as many components of `path' as there are before the `**' */
+  if ((size_t)(s - pat) >= MAXPATHLEN)
+	return (FNM_NOMATCH);
+  memcpy(head, pat, s - pat);
+  head[s - pat] = '\0';
+  for (n = 1, t = head; (t = strchr(t, '/')) != NULL; t++)
+	n++;
+  for (t = path; (t = strchr(t, '/')) != NULL && --n > 0; t++)
+	;
+  /* the `**' needs something after it */
+  if (t == NULL)
+	return (FNM_NOMATCH);
+
+  t[0] = '\0';
+  ret = fnmatch(head, path, FNM_PATHNAME);
+  t[0] = '/';
+  if (ret != 0)
+	return (ret);
+
+  return (ign_match(s + 1, t + 1));
+}
+
+/*
+ * push the ignore files found in `dir' onto p->ignores. `fr' must
+ * have room for one frame per entry of ignfiles[], plus one for the
+ * global excludes when `dir' is a starting point. the caller pops
+ * them by restoring p->ignores.
+ */
+int
+push_ignore(const char *dir, istack_t *fr, plan_t *p)
+{
+  int i, n;
+  size_t baselen;
+  char buf[MAXPATHLEN];
+  const char *s;
+  struct stat stbuf;
+  ignore_t *ign;
+
+  if (dir == NULL || fr == NULL || p == NULL)
+	return (-1);
+
+  n = 0;
+  baselen = strlen(dir);
+
+  if (p->ignores == NULL) {
+	if (!global_loaded) {
+	  global_loaded = 1;
+	  if ((s = getenv("XDG_CONFIG_HOME")) != NULL && s[0] != '\0')
+		snprintf(buf, MAXPATHLEN, "%s/git/ignore", s);
+	  else if ((s = getenv("HOME")) != NULL)
+		snprintf(buf, MAXPATHLEN, "%s/.config/git/ignore", s);
+	  else
+		buf[0] = '\0';
+	  if (buf[0] != '\0')
+		global = ign_load(buf);
+	}
+	if (global != NULL) {
+	  fr[n].ign = global;
+	  fr[n].baselen = baselen;
+	  fr[n].parent = p->ignores;
+	  p->ignores = &fr[n++];
+	}
+  }
+
+  for (i = 0; ignfiles[i] != NULL; i++) {
+	snprintf(buf, MAXPATHLEN, "%s%s%s", dir,
+			 (baselen > 0 && dir[baselen - 1] == '/') ? "" : "/",
+			 (i == 0) ? ".git" : ignfiles[i]);
+	if (i == 0) {
+	  if (stat(buf, &stbuf) < 0 || !S_ISDIR(stbuf.st_mode))
+		continue;
+	  strlcat(buf, ignfiles[i] + 4, MAXPATHLEN);
+	}
+	if ((ign = ign_load(buf)) == NULL || ign->size == 0)
+	  continue;
+	fr[n].ign = ign;
+	fr[n].baselen = baselen;
+	fr[n].parent = p->ignores;
+	p->ignores = &fr[n++];
+  }
+
+  return (n);
+}
+
+/*
+ * the innermost ignore file decides, and within a file the last
+ * matching rule does, as in git(1).
+ */
+int
+ignored(const char *path, size_t len, int isdir, plan_t *p)
+{
+  int i, fl, ret;
+  const char *rel, *base;
+  char buf[MAXPATHLEN];
+  istack_t *fr;
+  irule_t *r;
+
+  if ((base = strrchr(path, '/')) != NULL)
+	base++;
+  else
+	base = path;
+
+  for (fr = p->ignores; fr != NULL; fr = fr->parent) {
+	if (fr->baselen > len)
+	  continue;
+	rel = path + fr->baselen;
+	while (rel[0] == '/')
+	  rel++;
+	for (i = (int)fr->ign->size - 1; i >= 0; i--) {
+	  r = &(fr->ign->rules[i]);
+	  if (r->dironly && !isdir)
+		continue;
+	  if (r->dstar) {
+		strlcpy(buf, rel, MAXPATHLEN);
+		ret = ign_match(r->pattern, buf);
+	  } else {
+		fl = r->anchored ? FNM_PATHNAME : 0;
+		ret = fnmatch(r->pattern, r->anchored ? rel : base, fl);
+	  }
+	  if (ret == 0)
+		return (!r->negate);
+	}
+  }
+
+  return (0);
+}
+
+void
+free_ignore(void)
+{
+  int i;
+  unsigned int j;
+  ignore_t *tmp;
+
+  for (i = 0; i < NBUCKETS; i++) {
+	while (cache[i] != NULL) {
+	  tmp = cache[i];
+	  cache[i] = tmp->next;
+	  for (j = 0; j < tmp->size; j++)
+		free(tmp->rules[j].pattern);
+	  free(tmp->rules);
+	  free(tmp);
+	}
+  }
+
+  global = NULL;
+  global_loaded = 0;
+}
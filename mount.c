@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2005-2010 Denise H. G. <darcsis@gmail.com>
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * --fstype and --skip-fstype: the mount table is read once into a
+ * table of devices, each with its verdict, so a directory costs
+ * a single lookup by st_dev.
+ */
+
+#ifndef __linux__
+#include <sys/mount.h>
+#endif
+
+#include "search.h"
+
+#define NFSTYPES 32
+
+/* pseudo file systems skipped unless --skip-fstype says otherwise */
+static const char *pseudofs[] = {
+  "autofs", "binfmt_misc", "bpf", "cgroup", "cgroup2", "configfs",
+  "debugfs", "devpts", "efivarfs", "fusectl", "hugetlbfs", "mqueue",
+  "nsfs", "proc", "pstore", "securityfs", "selinuxfs", "sysfs",
+  "tracefs", "procfs", "linprocfs", "linsysfs", "fdescfs", "devfs",
+  NULL
+};
+
+static const char *match[NFSTYPES + 1];
+static const char *skip[NFSTYPES + 1];
+static int nmatch, nskip;
+/* the table is read when first asked for, and once only */
+static int loaded;
+
+static int  fs_listed(const char **, const char *);
+static int  mnt_add(mtab_t *, dev_t, const char *);
+static int  init_mounts(plan_t *);
+
+int  add_fstype(const char *, int, plan_t *);
+unsigned int mount_flags(dev_t, plan_t *);
+void free_mounts(mtab_t **);
+
+/*
+ * remember `type' for --fstype, or for --skip-fstype when `skipfs'
+ * is set. the first --skip-fstype replaces the default list.
+ */
+int
+add_fstype(const char *type, int skipfs, plan_t *p)
+{
+  if (type == NULL || p == NULL)
+	return (-1);
+
+  if ((skipfs ? nskip : nmatch) == NFSTYPES) {
+	warnx("%s: too many file system types", type);
+	return (-1);
+  }
+
+  if (skipfs) {
+	skip[nskip++] = type;
+	skip[nskip] = NULL;
+  } else {
+	match[nmatch++] = type;
+	match[nmatch] = NULL;
+  }
+
+  return (0);
+}
+
+static int
+fs_listed(const char **list, const char *type)
+{
+  int i;
+
+  for (i = 0; list[i] != NULL; i++)
+	if (strcmp(list[i], type) == 0)
+	  return (1);
+
+  return (0);
+}
+
+static int
+mnt_add(mtab_t *mt, dev_t dev, const char *type)
+{
+  size_t n;
+  unsigned int fl;
+
+  /* asking for a type with --fstype takes it off the default list */
+  fl = 0;
+  if (fs_listed(match, type))
+	fl |= MT_MATCH;
+  if (nskip > 0 ? fs_listed(skip, type) :
+	  (!(fl & MT_MATCH) && fs_listed(pseudofs, type)))
+	fl |= MT_SKIP;
+
+  if (mt->n + 1 > mt->size / 2)
+	return (-1);
+
+  for (n = (size_t)(dev * 0x9e3779b1U) & (mt->size - 1); mt->tab[n].used;
+	   n = (n + 1) & (mt->size - 1)) {
+	/* bind mounts show up more than once */
+	if (mt->tab[n].dev == dev)
+	  return (0);
+  }
+
+  mt->tab[n].used = 1;
+  mt->tab[n].dev = dev;
+  mt->tab[n].flags = fl;
+  mt->n++;
+
+  return (0);
+}
+
+/*
+ * read /proc/self/mountinfo, or getmntinfo(3) where there is no
+ * such thing. the devices come from the statfs data, as a stat(2)
+ * of every mount point could hang on a dead NFS server.
+ */
+static int
+init_mounts(plan_t *p)
+{
+  mtab_t *mt;
+#ifdef __linux__
+  unsigned int maj, min;
+  size_t nlines;
+  char line[LINE_MAX * 2], type[NAME_MAX], *s;
+  FILE *fp;
+#else
+  int i, n;
+  struct statfs *mntbuf;
+#endif
+
+  if (p == NULL)
+	return (-1);
+
+  if ((mt = (mtab_t *)malloc(sizeof(mtab_t))) == NULL)
+	return (-1);
+  bzero(mt, sizeof(mtab_t));
+
+#ifdef __linux__
+  if ((fp = fopen("/proc/self/mountinfo", "r")) == NULL) {
+	warn("/proc/self/mountinfo");
+	free(mt);
+	return (-1);
+  }
+
+  for (nlines = 0; fgets(line, sizeof(line), fp) != NULL; nlines++)
+	;
+  for (mt->size = 64; mt->size < nlines * 2 + 2; mt->size *= 2)
+	;
+  if ((mt->tab = (mnt_t *)calloc(mt->size, sizeof(mnt_t))) == NULL) {
+	fclose(fp);
+	free(mt);
+	return (-1);
+  }
+
+  /* id parent major:minor root mountpoint options ... - fstype ... */
+  rewind(fp);
+  while (fgets(line, sizeof(line), fp) != NULL) {
+	if (sscanf(line, "%*u %*u %u:%u", &maj, &min) != 2 ||
+		(s = strstr(line, " - ")) == NULL ||
+		sscanf(s + 3, "%254s", type) != 1)
+	  continue;
+	mnt_add(mt, makedev(maj, min), type);
+  }
+
+  fclose(fp);
+#else
+  if ((n = getmntinfo(&mntbuf, MNT_NOWAIT)) == 0) {
+	warn("getmntinfo");
+	free(mt);
+	return (-1);
+  }
+
+  for (mt->size = 64; mt->size < (size_t)n * 2 + 2; mt->size *= 2)
+	;
+  if ((mt->tab = (mnt_t *)calloc(mt->size, sizeof(mnt_t))) == NULL) {
+	free(mt);
+	return (-1);
+  }
+
+  /* st_dev is what the kernel has for f_fsid.val[0] */
+  for (i = 0; i < n; i++)
+	mnt_add(mt, (dev_t)mntbuf[i].f_fsid.val[0], mntbuf[i].f_fstypename);
+#endif
+
+#ifdef _DEBUG_
+  warnx("%lu mounted file system(s)", (unsigned long)mt->n);
+#endif
+
+  p->mounts = mt;
+  return (0);
+}
+
+/*
+ * MT_* of the file system on `dev', 0 if it was not mounted then.
+ * a walk that never leaves the file system of its root, and asks for
+ * no type, never reads the table.
+ */
+unsigned int
+mount_flags(dev_t dev, plan_t *p)
+{
+  size_t n;
+  mtab_t *mt;
+
+  if (!loaded) {
+	loaded = 1;
+	(void)init_mounts(p);
+  }
+
+  /* without a mount table, nothing is skipped */
+  if ((mt = p->mounts) == NULL)
+	return (0);
+
+  for (n = (size_t)(dev * 0x9e3779b1U) & (mt->size - 1); mt->tab[n].used;
+	   n = (n + 1) & (mt->size - 1)) {
+	if (mt->tab[n].dev == dev)
+	  return (mt->tab[n].flags);
+  }
+
+  return (0);
+}
+
+void
+free_mounts(mtab_t **mounts)
+{
+  mtab_t *mt = *mounts;
+
+  loaded = 0;
+  if (mt == NULL)
+	return;
+
+  free(mt->tab);
+  free(mt);
+  *mounts = NULL;
+  nmatch = nskip = 0;
+  match[0] = skip[0] = NULL;
+}
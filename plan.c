@@ -37,14 +37,26 @@ extern int s_empty(const char *, plan_t *);
 extern int s_xdev(const char *, plan_t *);
 extern int s_sort(const char *, plan_t *);
 extern int s_delete(const char *, plan_t *);
+extern int s_exec(const char *, plan_t *);
 extern int s_path(const char *, plan_t *);
 extern int s_type(const char *, plan_t *);
+extern int s_size(const char *, plan_t *);
+extern int s_time(const char *, plan_t *);
+extern int s_perm(const char *, plan_t *);
+extern int s_links(const char *, plan_t *);
+extern int s_fstype(const char *, plan_t *);
 extern int s_getids(const char *, plan_t *);
 extern int s_nogroup(const char *, plan_t *);
 extern int s_nouser(const char *, plan_t *);
 extern int s_version(const char *, plan_t *);
 extern int s_usage(const char *, plan_t *);
+extern int init_eval(plan_t *);
 
+/*
+ * exec: 0 - run once by plan_execute(),
+ *       1 - run on every node by walk_through(),
+ *       2 - like 1, but also on nodes above --mindepth.
+ */
 static const FLAGS flags[] = {
   /* ===== order start ===== */
   { OPT_VERSION, &s_version, "version",  0 },
@@ -52,32 +64,49 @@ static const FLAGS flags[] = {
   { OPT_IDS,     &s_getids,  "getids",   0 },
   { OPT_SORT,    &s_sort,    "sort",     0 },
   { OPT_PATH,    &s_path,    "path",     0 },
-  { OPT_STAT,    &s_stat,    "stat",     1 },
-  { OPT_LSTAT,   &s_lstat,   "lstat",    1 },
+  { OPT_STAT,    &s_stat,    "stat",     2 },
+  { OPT_LSTAT,   &s_lstat,   "lstat",    2 },
   /* ===== order end ===== */
   { OPT_EMPTY,   &s_empty,   "empty",    1 },
   { OPT_GRP,     &s_gid,     "gid",      1 },
   { OPT_USR,     &s_uid,     "uid",      1 },
   { OPT_TYPE,    &s_type,    "type",     1 },
+  { OPT_SIZE,    &s_size,    "size",     1 },
+  { OPT_TIME,    &s_time,    "time",     1 },
+  { OPT_PERM,    &s_perm,    "perm",     1 },
+  { OPT_LINKS,   &s_links,   "links",    1 },
+  { OPT_FSTYPE,  &s_fstype,  "fstype",   1 },
   { OPT_NGRP,    &s_nogroup, "no_group", 1 },
   { OPT_NAME,    &s_name,    "name",     1 },
   { OPT_REGEX,   &s_regex,   "regex",    1 },
   { OPT_NUSR,    &s_nouser,  "no_user",  1 },
   /* ===== order start ===== */
-  { OPT_XDEV,    &s_xdev,    "xdev",     1 },
+  { OPT_XDEV,    &s_xdev,    "xdev",     2 },
   { OPT_DEL,     &s_delete,  "delete",   1 },
+  { OPT_EXEC,    &s_exec,    "exec",     1 },
   /* ===== order end ===== */
   { OPT_NONE,    NULL,        NULL },
 };
 
+/* those between the two ordered parts of flags[] */
+#define OPT_FREE (OPT_EMPTY | OPT_GRP | OPT_USR | OPT_TYPE | OPT_SIZE | \
+				  OPT_TIME | OPT_PERM | OPT_LINKS | OPT_FSTYPE | OPT_NGRP | \
+				  OPT_NAME | OPT_REGEX | OPT_NUSR)
+#define NFREE 16
+
+static unsigned int stat_fields(unsigned int, args_t *);
 static int plan_add(unsigned int *, plist_t *);
 static int plan_execute(plan_t *);
+static double plan_rank(PLAN *);
 
 int  init_plan(plan_t *);
 int  find_plan(int, char **, plan_t *);
 int  execute_plan(plan_t *);
 int  add_plan(plan_t *);
+int  add_prune(const char *, plan_t *);
+void plan_reorder(plist_t *);
 void free_plan(plist_t **);
+void free_prune(prune_t **);
 
 int
 init_plan(plan_t *p)
@@ -93,15 +122,59 @@ init_plan(plan_t *p)
 	return (-1);
   }
 
+  p->pfd = -1;
+  p->pst = NULL;
+  p->ignores = NULL;
+  p->exec = NULL;
+  p->fmt = NULL;
+  p->eval = NULL;
+  p->gsort = NULL;
+  p->dupes = NULL;
+  bzero(&(p->dirs), sizeof(dset_t));
+  p->snap = NULL;
+  p->ckpt = NULL;
+  p->root = 0;
+  p->rootlen = 0;
+  p->mounts = NULL;
+  p->rootdev = 0;
+  p->devs = NULL;
+  p->ndevs = 0;
+  p->deldir = 0;
+  p->nmatch = 0;
+  p->ndeleted = p->nfailed = 0;
+  p->stop = 0;
   bzero(p->mt->pattern, LINE_MAX);
   p->mt->mflag = REG_BASIC;
   p->args->odev = 0;
   p->args->empty = 0;
+  p->args->need_time = 0;
+  p->args->perm = 0;
+  p->args->permop = '=';
   p->args->need_xdev = p->args->need_sort = 0;
+  p->args->need_inosort = 0;
+  p->args->need_ignore = 0;
+  p->args->need_stat = NS_TYPE;
+  p->args->nosync = 0;
+  p->args->follow = p->args->once = 0;
+  p->args->need_stream = 0;
+  p->args->maxresults = 0;
+  p->args->need_gsort = 0;
+  p->args->need_stats = 0;
+  p->args->need_uring = 0;
+  p->args->filesfrom = NULL;
+  p->args->null = 0;
+  p->args->sortmem = 64 * 1024 * 1024;
+  p->args->mindepth = 0;
+  p->args->maxdepth = -1;
+  p->args->shard = 0;
+  p->args->nshards = 1;
+  p->args->sharddepth = 1;
+  p->args->prune = NULL;
   p->flags = OPT_NONE | OPT_NAME | OPT_LSTAT;
   
   p->plans->cur = p->plans->start = NULL;
   p->plans->size = 0;
+  p->plans->nvisits = 0;
     
   return (0);
 }
@@ -116,7 +189,7 @@ find_plan(int argc, char **argv, plan_t *p)
 	return (-1);
   
   if (argc == 0) {
-	if (dl_empty(p->paths)) {
+	if (dl_empty(p->paths) && p->args->filesfrom == NULL) {
 	  p->flags |= OPT_USAGE;
 	}
 	return (0);
@@ -141,6 +214,16 @@ add_plan(plan_t *p)
   if (p == NULL)
 	return (-1);
 
+  p->args->need_stat = stat_fields(p->flags, p->args);
+  if (p->fmt != NULL)
+	p->args->need_stat |= p->fmt->need;
+  if (p->dupes != NULL)
+	p->args->need_stat |= NS_SIZE | NS_INO;
+  /* plan_add() clears the flags it takes */
+  p->args->follow = ((p->flags & OPT_STAT) != 0);
+  if (init_eval(p) < 0)
+	return (-1);
+
   return (plan_add(&(p->flags), p->plans));
 }
 
@@ -153,6 +236,47 @@ execute_plan(plan_t *p)
   return (plan_execute(p));
 }
 
+int
+add_prune(const char *pattern, plan_t *p)
+{
+  prune_t *new;
+
+  if (pattern == NULL || p == NULL || p->args == NULL)
+	return (-1);
+
+  if ((new = (prune_t *)malloc(sizeof(prune_t))) == NULL)
+	return (-1);
+
+  if ((new->pattern = strdup(pattern)) == NULL) {
+	free(new);
+	return (-1);
+  }
+
+  /* patterns without any wildcard are compared with strcmp(3). */
+  new->literal = (strpbrk(pattern, "*?[\\") == NULL);
+  new->next = p->args->prune;
+  p->args->prune = new;
+
+#ifdef _DEBUG_
+  warnx("added prune: %s (%s)", pattern, new->literal ? "literal" : "glob");
+#endif
+
+  return (0);
+}
+
+void
+free_prune(prune_t **prune)
+{
+  prune_t *tmp;
+
+  while (*prune != NULL) {
+	tmp = *prune;
+	*prune = tmp->next;
+	free(tmp->pattern);
+	free(tmp);
+  }
+}
+
 void
 free_plan(plist_t **plist)
 {
@@ -192,6 +316,32 @@ free_plan(plist_t **plist)
   }
 }
 
+static unsigned int
+stat_fields(unsigned int fl, args_t *args)
+{
+  unsigned int need;
+
+  /* the type decides whether to descend. */
+  need = NS_TYPE;
+
+  if (fl & (OPT_USR | OPT_NUSR))
+	need |= NS_UID;
+  if (fl & (OPT_GRP | OPT_NGRP))
+	need |= NS_GID;
+  if (fl & OPT_EMPTY)
+	need |= NS_SIZE | NS_EMPTY;
+  if (fl & OPT_SIZE)
+	need |= NS_SIZE;
+  if (fl & OPT_TIME)
+	need |= args->need_time;
+  if (fl & OPT_PERM)
+	need |= NS_MODE;
+  if (fl & OPT_LINKS)
+	need |= NS_NLINK;
+
+  return (need);
+}
+
 static int
 plan_add(unsigned int *fl, plist_t *pl)
 {
@@ -212,6 +362,9 @@ plan_add(unsigned int *fl, plist_t *pl)
 	  new->s_func = flags[i].s_func;
 	  new->func_name = (char *)flags[i].name;
 	  new->exec = flags[i].exec;
+	  new->free = ((flags[i].opt & OPT_FREE) != 0);
+	  new->ncalls = new->nfails = new->ntimed = 0;
+	  new->nsecs = 0;
 	  
 	  if (pl->start == NULL) {
 		pl->cur = pl->start = new;
@@ -253,7 +406,7 @@ plan_execute(plan_t *p)
 
   while (p->plans->cur != NULL) {
 	
-	if (p->plans->cur->exec != 1)
+	if (p->plans->cur->exec == 0)
 	  p->plans->retval = p->plans->cur->s_func(NULL, p);
 	
 	if (p->plans->cur) {
@@ -266,3 +419,78 @@ plan_execute(plan_t *p)
 
   return (p->plans->retval);
 }
+
+/*
+ * the expected time a filter takes to reject a node, smoothed so
+ * that one not run yet, or never rejecting anything, still ranks.
+ */
+static double
+plan_rank(PLAN *pn)
+{
+  double cost;
+
+  cost = (pn->ntimed > 0) ? (double)pn->nsecs / pn->ntimed : 0;
+
+  return (cost * (pn->ncalls + 1) / (pn->nfails + 1));
+}
+
+/*
+ * put the free filters in the order that rejects a node the soonest,
+ * from what they have done so far. the counters are then halved, so
+ * that a change in the tree shows in the next order.
+ */
+void
+plan_reorder(plist_t *pl)
+{
+  int i, j, n;
+  double rank[NFREE], r;
+  PLAN *prev, *fr[NFREE], *tmp;
+
+  if (pl == NULL)
+	return;
+
+  prev = NULL;
+  for (pl->cur = pl->start; pl->cur != NULL && !pl->cur->free;
+	   pl->cur = pl->cur->next)
+	prev = pl->cur;
+
+  for (n = 0; pl->cur != NULL && pl->cur->free && n < NFREE;
+	   pl->cur = pl->cur->next) {
+	fr[n] = pl->cur;
+	rank[n++] = plan_rank(pl->cur);
+  }
+
+  if (n < 2)
+	return;
+
+  /* a stable insertion sort, the list is a handful long */
+  for (i = 1; i < n; i++) {
+	tmp = fr[i];
+	r = rank[i];
+	for (j = i; j > 0 && rank[j - 1] > r; j--) {
+	  fr[j] = fr[j - 1];
+	  rank[j] = rank[j - 1];
+	}
+	fr[j] = tmp;
+	rank[j] = r;
+  }
+
+  if (prev == NULL)
+	pl->start = fr[0];
+  else
+	prev->next = fr[0];
+  for (i = 0; i < n; i++) {
+	fr[i]->next = (i + 1 < n) ? fr[i + 1] : pl->cur;
+	fr[i]->ncalls >>= 1;
+	fr[i]->nfails >>= 1;
+	if (fr[i]->ntimed > 1) {
+	  fr[i]->ntimed >>= 1;
+	  fr[i]->nsecs >>= 1;
+	}
+  }
+
+#ifdef _DEBUG_
+  for (i = 0; i < n; i++)
+	warnx("reordered plan(%d): %s", i, fr[i]->func_name);
+#endif
+}
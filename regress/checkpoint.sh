@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# a walk interrupted by SIGINT and gone on with by --resume prints
+# what a plain walk does, in the same order, with and without
+# --stream.
+
+SEARCH=${SEARCH:-./search}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir" || exit 1
+# enough names to outgrow the pipe, so the walk is still going when
+# it is interrupted
+names=
+for x in 0 1 2; do
+	for y in 0 1 2 3 4 5 6 7 8 9; do
+		names="$names file-with-a-long-name-$x$y"
+	done
+done
+for a in a b c d e f g h; do
+	for b in 0 1 2 3 4 5 6 7 8 9; do
+		mkdir -p "t/$a/$b"
+		(cd "t/$a/$b" && touch $names)
+	done
+done
+mkfifo fifo
+
+# run `search -f t "$@"', reading 100 lines of it before SIGINT
+cut() {
+	"$SEARCH" -f t "$@" > fifo &
+	pid=$!
+	{
+		i=0
+		while [ $i -lt 100 ] && IFS= read -r line; do
+			printf '%s\n' "$line"
+			i=$((i + 1))
+		done
+		kill -INT $pid 2>/dev/null
+		cat
+	} < fifo >> out
+	wait $pid
+}
+
+fail=0
+for args in "" "--stream"; do
+	"$SEARCH" -f t $args > all
+	rm -f ck out
+	cut $args --checkpoint ck
+	rc=$?
+	n=0
+	while [ $rc -ne 0 ] && [ $n -lt 100 ]; do
+		n=$((n + 1))
+		cut $args --resume ck
+		rc=$?
+	done
+	if [ $n -eq 0 ]; then
+		echo "FAIL: --checkpoint $args: the walk was not interrupted" >&2
+		fail=1
+	fi
+	if [ $rc -ne 0 ] || [ -e ck ]; then
+		echo "FAIL: --resume $args: the walk did not get to the end" >&2
+		fail=1
+	fi
+	if ! cmp -s out all; then
+		echo "FAIL: --checkpoint $args: output differs from a plain walk" >&2
+		fail=1
+	fi
+done
+
+exit $fail
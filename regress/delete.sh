@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# --delete removes what a plain walk with the same filters finds, and
+# nothing else, the directories among it once they are emptied.
+
+SEARCH=${SEARCH:-./search}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir" || exit 1
+
+fail=0
+for args in "-n x*" "-t f -n x*" "-n x* --stream"; do
+	rm -rf t
+	for a in a b c; do
+		mkdir -p "t/$a/keep" "t/$a/xdir/xsub"
+		touch "t/$a/x1" "t/$a/y1" "t/$a/keep/x2" "t/$a/keep/y2" \
+			"t/$a/xdir/x3" "t/$a/xdir/xsub/x4"
+	done
+
+	"$SEARCH" -f t | sort > before
+	"$SEARCH" -f t $args | sort > found
+	if ! "$SEARCH" -f t $args --delete > /dev/null; then
+		echo "FAIL: --delete $args: exited with an error" >&2
+		fail=1
+	fi
+	"$SEARCH" -f t | sort > after
+	if ! comm -23 before found | cmp -s - after; then
+		echo "FAIL: --delete $args: left differs from a plain walk" >&2
+		fail=1
+	fi
+done
+
+exit $fail
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# --duplicates groups the regular files a plain walk finds by their
+# contents: the same size or the same head is not enough, empty files
+# are left out and a file met again by a hard link counts once.
+
+SEARCH=${SEARCH:-./search}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir" || exit 1
+mkdir -p t/a t/b/c
+# 8 kilobytes, the same but for their last byte
+i=0
+while [ $i -lt 128 ]; do
+	printf '%063d\n' $i
+	i=$((i + 1))
+done > head
+{ cat head; printf 'x'; } > t/a/big1
+{ cat head; printf 'x'; } > t/b/big2
+{ cat head; printf 'y'; } > t/b/c/big3
+printf 'same\n' > t/a/s1
+printf 'same\n' > t/b/s2
+printf 'same\n' > t/b/c/s3
+printf 'diff\n' > t/a/d1
+printf 'other contents\n' > t/a/o1
+: > t/a/e1
+: > t/b/e2
+ln t/a/o1 t/b/o2
+mkdir t/b/same
+
+fail=0
+for args in "" "-n [bs]*[12]" "--stream"; do
+	got=$("$SEARCH" -f t $args --duplicates | sort)
+	# only the results are grouped
+	case $args in
+	-n*)
+		w="t/a/big1	t/b/big2
+t/a/s1	t/b/s2" ;;
+	*)
+		w="t/a/big1	t/b/big2
+t/a/s1	t/b/c/s3	t/b/s2" ;;
+	esac
+	if [ "$got" != "$w" ]; then
+		echo "FAIL: --duplicates $args" >&2
+		fail=1
+	fi
+	# nothing a plain walk does not find
+	"$SEARCH" -f t $args -t f | sort > all
+	printf '%s\n' "$got" | tr '\t' '\n' | sort | comm -23 - all > extra
+	if [ -s extra ]; then
+		echo "FAIL: --duplicates $args: names a plain walk does not find" >&2
+		fail=1
+	fi
+done
+
+exit $fail
@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# --exec runs its command on every result a plain walk finds, once
+# each with `;' and in batches within ARG_MAX with `{} +', however
+# many jobs run at once.
+
+SEARCH=${SEARCH:-./search}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir" || exit 1
+names=
+for x in 0 1 2 3 4 5 6 7 8 9; do
+	for y in 0 1 2 3 4 5 6 7 8 9; do
+		names="$names a-name-long-enough-to-fill-argv-up-quickly-$x$y"
+	done
+done
+for a in a b c d e f g h i j k l m n o p q r s t; do
+	for b in 0 1; do
+		mkdir -p "t/$a/$b"
+		(cd "t/$a/$b" && touch $names)
+	done
+done
+
+# the smallest stack gives the smallest ARG_MAX, of 128 kilobytes
+ulimit -s 512 2>/dev/null
+
+"$SEARCH" -f t | sort > all
+
+fail=0
+for jobs in 1 4; do
+	"$SEARCH" -f t -j $jobs --exec sh -c 'echo batch >&2; printf "%s\n" "$@"' \
+		sh {} + 2> batches | sort > got
+	if ! cmp -s got all; then
+		echo "FAIL: --exec {} + -j $jobs: differs from a plain walk" >&2
+		fail=1
+	fi
+	if [ $(grep -c batch batches) -lt 2 ]; then
+		echo "FAIL: --exec {} + -j $jobs: all in one batch" >&2
+		fail=1
+	fi
+
+	"$SEARCH" -f t -t d -j $jobs --exec echo {} \; | sort > got
+	"$SEARCH" -f t -t d | sort > want
+	if ! cmp -s got want; then
+		echo "FAIL: --exec ; -j $jobs: differs from a plain walk" >&2
+		fail=1
+	fi
+done
+
+exit $fail
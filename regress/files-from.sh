@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# the paths of a list given to --files-from with -0, names with a
+# newline among them, are filtered into what a plain walk with the
+# same filters finds.
+
+SEARCH=${SEARCH:-./search}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir" || exit 1
+for a in a b c; do
+	mkdir -p "t/$a/sub"
+	touch "t/$a/abc" "t/$a/sub/axe" "t/$a/xyz" "t/$a/with space" \
+		"t/$a/new
+line"
+done
+find t -print0 > list
+
+fail=0
+for args in "" "-n a*" "-t d" "-t f -r .*e.*" "--maxdepth 1"; do
+	# what is listed is not descended into, whatever its depth
+	case $args in
+	--maxdepth*)
+		want=$("$SEARCH" -f t | sort) ;;
+	*)
+		want=$("$SEARCH" -f t $args | sort) ;;
+	esac
+	got=$("$SEARCH" --files-from list -0 $args | sort)
+	if [ "$got" != "$want" ]; then
+		echo "FAIL: --files-from list -0 $args" >&2
+		fail=1
+	fi
+	got=$("$SEARCH" --files-from - -0 $args < list | sort)
+	if [ "$got" != "$want" ]; then
+		echo "FAIL: --files-from - -0 $args" >&2
+		fail=1
+	fi
+done
+
+exit $fail
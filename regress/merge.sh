@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# the parts of --shard, each sorted by --global-sort, are merged by
+# --merge into what a plain walk sorted as a whole prints.
+
+SEARCH=${SEARCH:-./search}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir" || exit 1
+for a in a b c d e; do
+	for b in 1 2 3; do
+		mkdir -p "r1/$a/$b" "r2/$a$b"
+		touch "r1/$a/$b/f" "r1/$a/G$b" "r1/$a/g-$b" "r2/$a$b/h"
+	done
+done
+
+"$SEARCH" -f r2 -f r1 | LC_ALL=C sort > all
+
+fail=0
+for args in "" "-t f" "--shard-depth 2"; do
+	for i in 0 1 2; do
+		"$SEARCH" -f r2 -f r1 $args --global-sort --shard $i/3 > part$i
+	done
+	"$SEARCH" -f r2 -f r1 $args | LC_ALL=C sort > want
+	"$SEARCH" --merge part0 part1 part2 > got
+	if ! cmp -s got want; then
+		echo "FAIL: --merge of --shard $args: differs from a plain walk" >&2
+		fail=1
+	fi
+	# the standard input is a part like the others
+	"$SEARCH" --merge part0 - part2 < part1 > got
+	if ! cmp -s got want; then
+		echo "FAIL: --merge - of --shard $args: differs from a plain walk" >&2
+		fail=1
+	fi
+done
+
+"$SEARCH" -f r2 -f r1 --global-sort > got
+if ! cmp -s got all; then
+	echo "FAIL: --global-sort: differs from a plain walk" >&2
+	fail=1
+fi
+
+exit $fail
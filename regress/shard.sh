@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# the parts of --shard, whatever the split depth, hold every node of
+# a plain walk once, and more than one of them has something.
+
+SEARCH=${SEARCH:-./search}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir" || exit 1
+for a in a b c d e; do
+	for b in 1 2 3; do
+		mkdir -p "r1/$a/$b" "r2/$a$b"
+		touch "r1/$a/$b/f" "r1/$a/g$b" "r2/$a$b/h"
+	done
+done
+for r in r3 r4 r5 r6; do
+	mkdir "$r"
+	touch "$r/x"
+done
+
+"$SEARCH" -f r1 -f r2 -f r3 -f r4 -f r5 -f r6 | sort > all
+
+fail=0
+for depth in 0 1 2 3; do
+	: > union
+	used=0
+	for i in 0 1 2; do
+		"$SEARCH" -f r1 -f r2 -f r3 -f r4 -f r5 -f r6 \
+			--shard $i/3 --shard-depth $depth > part
+		[ -s part ] && used=$((used + 1))
+		cat part >> union
+	done
+	if ! sort union | cmp -s - all; then
+		echo "FAIL: --shard-depth $depth: parts differ from a plain walk" >&2
+		fail=1
+	fi
+	if [ $used -lt 2 ]; then
+		echo "FAIL: --shard-depth $depth: $used part(s) in use" >&2
+		fail=1
+	fi
+done
+
+exit $fail
@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# a walk going by --snapshot prints what a plain walk does, whether
+# the directories are unchanged, changed or new since the snapshot
+# was saved, and does not read the unchanged ones again.
+
+SEARCH=${SEARCH:-./search}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cd "$dir" || exit 1
+for a in a b c; do
+	for b in 1 2 3; do
+		mkdir -p "t/$a/$b"
+		touch "t/$a/$b/f" "t/$a/$b/g" "t/$a/h$b"
+	done
+done
+# a directory changed within a second of the walk is not trusted
+sleep 2
+
+fail=0
+check() {
+	"$SEARCH" -f t $args | sort > all
+	"$SEARCH" -f t $args --snapshot snap --stats 2> stats | sort > got
+	if ! cmp -s got all; then
+		echo "FAIL: --snapshot $args, $1: output differs from a plain walk" >&2
+		fail=1
+	fi
+}
+
+for args in "-n f" "-t d" "-t f -n [fh]*"; do
+	rm -f snap
+	check "first walk"
+	check "unchanged"
+	if ! grep -q '^unchanged: [1-9]' stats; then
+		echo "FAIL: --snapshot $args: every directory read again" >&2
+		fail=1
+	fi
+	touch t/a/1/new t/b/f
+	rm t/c/2/f
+	mkdir t/c/4
+	touch t/c/4/f
+	check "changed"
+	rm -rf t/a/1/new t/b/f t/c/4
+	touch t/c/2/f
+done
+
+exit $fail
@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# a root given with a trailing slash is walked through as without it,
+# and -n and -r still see the names of its children.
+
+SEARCH=${SEARCH:-./search}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+mkdir -p "$dir/d/sub"
+touch "$dir/d/abc" "$dir/d/sub/axe" "$dir/d/xyz"
+
+cd "$dir" || exit 1
+want="d/abc
+d/sub/axe"
+
+fail=0
+for args in "-n a*" "-r a.*" "-t f -n a*" "-t f -r a.*"; do
+	for root in d d/ d//; do
+		got=$("$SEARCH" -f "$root" $args | sort)
+		if [ "$got" != "$want" ]; then
+			echo "FAIL: search -f $root $args" >&2
+			fail=1
+		fi
+	done
+done
+
+exit $fail
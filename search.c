@@ -26,6 +26,10 @@
  */
 
 #include <getopt.h>
+#include <grp.h>
+#include <pwd.h>
+#include <sysexits.h>
+#include <time.h>
 
 #include "search.h"
   
@@ -36,12 +40,43 @@ extern int init_plan(plan_t *);
 extern int find_plan(int, char **, plan_t *);
 extern int execute_plan(plan_t *);
 extern int add_plan(plan_t *);
+extern int add_prune(const char *, plan_t *);
 extern void free_plan(plist_t **);
+extern void free_prune(prune_t **);
+extern void free_ignore(void);
+extern void free_gsort(gsort_t **);
+extern int init_exec(int *, char **, plan_t *);
+extern void free_exec(exec_t **);
+extern int init_fmt(const char *, int, plan_t *);
+extern void free_fmt(fmt_t **);
+extern void free_eval(eval_t **);
+extern int init_dupes(plan_t *);
+extern void free_dupes(dupes_t **);
+extern int add_fstype(const char *, int, plan_t *);
+extern void free_mounts(mtab_t **);
+extern int init_snapshot(const char *, int, char **, plan_t *);
+extern void free_snapshot(snap_t **);
+extern int init_checkpoint(const char *, int, int, char **, plan_t *);
+extern void free_checkpoint(ckpt_t **);
+extern int gsort_merge(int, char **);
 
 static int opt_empty;
 static int opt_delete;
 
 static __inline void ftype_err(const char *);
+static __inline int num_arg(const char *, const char *);
+static __inline size_t size_arg(const char *, const char *);
+static __inline char cmp_arg(const char *, const char *, long long *,
+							  long long *);
+static __inline void count_arg(const char *, const char *, range_t *, int);
+static __inline void time_arg(const char *, const char *, long long,
+							  range_t *);
+static __inline void perm_arg(const char *);
+static __inline void shard_arg(const char *);
+static __inline void user_arg(const char *);
+static __inline void group_arg(const char *);
+
+static time_t now;
 static __inline void cleanup(int);
 
 static struct option longopts[] = {
@@ -60,6 +95,44 @@ static struct option longopts[] = {
 	{ "nouser",  no_argument,       NULL,        7  },
 	{ "version", no_argument,       NULL,       'v' },
 	{ "xdev",    no_argument,       NULL,       'x' },
+	{ "maxdepth", required_argument, NULL,       8  },
+	{ "mindepth", required_argument, NULL,       9  },
+	{ "prune",   required_argument, NULL,       10  },
+	{ "exclude", required_argument, NULL,       10  },
+	{ "ignore-files", no_argument,  NULL,       11  },
+	{ "nosync",  no_argument,       NULL,       12  },
+	{ "stream",  no_argument,       NULL,       13  },
+	{ "max-results", required_argument, NULL,    14  },
+	{ "quit",    no_argument,       NULL,       15  },
+	{ "global-sort", no_argument,   NULL,       16  },
+	{ "sort-memory", required_argument, NULL,    17  },
+	{ "stats",   no_argument,       NULL,       18  },
+	{ "jobs",    required_argument, NULL,       'j' },
+	{ "size",    required_argument, NULL,       19  },
+	{ "mmin",    required_argument, NULL,       20  },
+	{ "mtime",   required_argument, NULL,       21  },
+	{ "cmin",    required_argument, NULL,       22  },
+	{ "ctime",   required_argument, NULL,       23  },
+	{ "amin",    required_argument, NULL,       24  },
+	{ "atime",   required_argument, NULL,       25  },
+	{ "perm",    required_argument, NULL,       26  },
+	{ "links",   required_argument, NULL,       27  },
+	{ "printf",  required_argument, NULL,       28  },
+	{ "json-lines", no_argument,    NULL,       29  },
+	{ "once",    no_argument,       NULL,       30  },
+	{ "fstype",  required_argument, NULL,       31  },
+	{ "skip-fstype", required_argument, NULL,   32  },
+	{ "inode-order", no_argument,   NULL,       33  },
+	{ "snapshot", required_argument, NULL,      34  },
+	{ "checkpoint", required_argument, NULL,    35  },
+	{ "resume",  required_argument, NULL,       36  },
+	{ "shard",   required_argument, NULL,       37  },
+	{ "shard-depth", required_argument, NULL,   38  },
+	{ "merge",   no_argument,       NULL,       39  },
+	{ "files-from", required_argument, NULL,    40  },
+	{ "null",    no_argument,       NULL,       '0' },
+	{ "duplicates", no_argument,    NULL,       41  },
+	{ "io-uring", no_argument,      NULL,       42  },
 	{ NULL,      0,                 NULL,        0  }
   };
 
@@ -70,9 +143,16 @@ main(int argc, char *argv[])
 {
   int ch;
   int ret;
+  int resume = 0;
+  int merge = 0;
+  int jobs = -1;
+  const char *snapfile = NULL;
+  const char *ckptfile = NULL;
     
   (void)setlocale(LC_CTYPE, "");
   signal(SIGINT, cleanup);
+  /* every time filter is relative to this */
+  now = time(NULL);
 
   if (init_plan(&plan) < 0) {
 #ifdef _DEBUG_
@@ -82,19 +162,24 @@ main(int argc, char *argv[])
 	exit (1);
   }
 
-  while ((ch = getopt_long(argc, argv, "EILPsvxf:n:r:t:", longopts, NULL)) != -1)
+  if (init_exec(&argc, argv, &plan) < 0) {
+	cleanup(0);
+	exit (1);
+  }
+  if (plan.exec != NULL)
+	plan.flags |= OPT_EXEC;
+
+  while ((ch = getopt_long(argc, argv, "0EILPsvxf:j:n:r:t:", longopts, NULL)) != -1)
 	switch (ch) {
 	case 2:
 	case 3:
 	  plan.flags |= OPT_GRP;
-	  bzero(plan.args->sgid, LINE_MAX);
-	  strlcpy(plan.args->sgid, optarg, LINE_MAX);
+	  group_arg(optarg);
 	  break;
 	case 4:
 	case 5:
 	  plan.flags |=  OPT_USR;
-	  bzero(plan.args->suid, LINE_MAX);
-	  strlcpy(plan.args->suid, optarg, LINE_MAX);
+	  user_arg(optarg);
 	  break;
 	case 6:
       plan.flags |= OPT_NGRP;
@@ -104,6 +189,137 @@ main(int argc, char *argv[])
       plan.flags |= OPT_NUSR;
       plan.flags |= OPT_IDS;
       break;
+	case 8:
+	  plan.args->maxdepth = num_arg("--maxdepth", optarg);
+	  break;
+	case 9:
+	  plan.args->mindepth = num_arg("--mindepth", optarg);
+	  break;
+	case 10:
+	  if (add_prune(optarg, &plan) < 0) {
+		warnx("--prune: %s: cannot add pattern", optarg);
+		cleanup(0);
+		exit (1);
+	  }
+	  break;
+	case 11:
+	  plan.args->need_ignore = 1;
+	  break;
+	case 12:
+	  plan.args->nosync = 1;
+	  break;
+	case 13:
+	  plan.args->need_stream = 1;
+	  break;
+	case 14:
+	  plan.args->maxresults = num_arg("--max-results", optarg);
+	  break;
+	case 15:
+	  plan.args->maxresults = 1;
+	  break;
+	case 16:
+	  plan.args->need_gsort = 1;
+	  break;
+	case 17:
+	  plan.args->sortmem = size_arg("--sort-memory", optarg);
+	  break;
+	case 18:
+	  plan.args->need_stats = 1;
+	  break;
+	case 19:
+	  plan.flags |= OPT_SIZE;
+	  count_arg("--size", optarg, &(plan.args->size), 1);
+	  break;
+	case 20:
+	case 21:
+	  plan.flags |= OPT_TIME;
+	  plan.args->need_time |= NS_MTIME;
+	  time_arg((ch == 20) ? "--mmin" : "--mtime", optarg,
+			   (ch == 20) ? 60 : 86400,
+			   &(plan.args->mtime));
+	  break;
+	case 22:
+	case 23:
+	  plan.flags |= OPT_TIME;
+	  plan.args->need_time |= NS_CTIME;
+	  time_arg((ch == 22) ? "--cmin" : "--ctime", optarg,
+			   (ch == 22) ? 60 : 86400,
+			   &(plan.args->ctime));
+	  break;
+	case 24:
+	case 25:
+	  plan.flags |= OPT_TIME;
+	  plan.args->need_time |= NS_ATIME;
+	  time_arg((ch == 24) ? "--amin" : "--atime", optarg,
+			   (ch == 24) ? 60 : 86400,
+			   &(plan.args->atime));
+	  break;
+	case 26:
+	  plan.flags |= OPT_PERM;
+	  perm_arg(optarg);
+	  break;
+	case 27:
+	  plan.flags |= OPT_LINKS;
+	  count_arg("--links", optarg, &(plan.args->links), 0);
+	  break;
+	case 28:
+	case 29:
+	  if (init_fmt(optarg, ch == 29, &plan) < 0) {
+		cleanup(0);
+		exit (1);
+	  }
+	  break;
+	case 30:
+	  plan.args->once = 1;
+	  break;
+	case 31:
+	  plan.flags |= OPT_FSTYPE;
+	  /* FALLTHROUGH */
+	case 32:
+	  if (add_fstype(optarg, ch == 32, &plan) < 0) {
+		cleanup(0);
+		exit (1);
+	  }
+	  break;
+	case 33:
+	  plan.args->need_inosort = 1;
+	  break;
+	case 34:
+	  snapfile = optarg;
+	  break;
+	case 37:
+	  shard_arg(optarg);
+	  break;
+	case 38:
+	  plan.args->sharddepth = num_arg("--shard-depth", optarg);
+	  break;
+	case 39:
+	  merge = 1;
+	  break;
+	case 40:
+	  plan.flags |= OPT_PATH;
+	  plan.args->filesfrom = optarg;
+	  break;
+	case '0':
+	  plan.args->null = 1;
+	  break;
+	case 42:
+	  plan.args->need_uring = 1;
+	  break;
+	case 41:
+	  if (plan.dupes == NULL && init_dupes(&plan) < 0) {
+		cleanup(0);
+		exit (1);
+	  }
+	  break;
+	case 35:
+	case 36:
+	  ckptfile = optarg;
+	  resume = (ch == 36);
+	  break;
+	case 'j':
+	  jobs = num_arg("--jobs", optarg);
+	  break;
 	case 'f':
 	  plan.flags |= OPT_PATH;
 	  dl_append(optarg, plan.paths);
@@ -129,14 +345,8 @@ main(int argc, char *argv[])
 	case 0:
 	  if (opt_empty == 1)
 		plan.flags |= OPT_EMPTY;
-	  if (opt_delete == 1) {
+	  if (opt_delete == 1)
 		plan.flags |=  OPT_DEL;
-		if ((plan.rfiles = dl_init()) == NULL ||
-			(plan.rdirs = dl_init()) == NULL) {
-		  warnx("error initiating lists for deletion!");
-		  return (-1);
-		}
-	  }
 	  break;
 	case 's':
 	  plan.flags |= OPT_SORT;
@@ -203,6 +413,82 @@ main(int argc, char *argv[])
 	  break;
 	}
 
+  if ((plan.flags & OPT_EXEC) && (plan.flags & OPT_DEL)) {
+	warnx("--exec and --delete cannot be used together");
+	cleanup(0);
+	exit (1);
+  }
+
+  if (jobs >= 0 && plan.exec == NULL) {
+	warnx("--jobs only works with --exec");
+	cleanup(0);
+	exit (1);
+  }
+
+  if (plan.exec != NULL)
+	plan.exec->njobs = (jobs > 0) ? jobs : 1;
+
+  /* no walk, only the outputs of the shards */
+  if (merge) {
+	ret = gsort_merge(argc - optind, argv + optind);
+	cleanup(0);
+	return (ret);
+  }
+
+  /* the groups are only known once everything is found */
+  if (plan.dupes != NULL &&
+	  ((plan.flags & (OPT_DEL | OPT_EXEC)) || plan.fmt != NULL ||
+	   plan.args->need_gsort || snapfile != NULL || ckptfile != NULL)) {
+	warnx("--duplicates cannot be used with --delete, --exec, --printf, "
+		  "--global-sort, --snapshot or --checkpoint");
+	cleanup(0);
+	exit (1);
+  }
+
+  /* both remember where they are in the walk, there is none here */
+  if (plan.args->filesfrom != NULL && (snapfile != NULL || ckptfile != NULL)) {
+	warnx("--files-from cannot be used with --snapshot or --checkpoint");
+	cleanup(0);
+	exit (1);
+  }
+
+  /*
+   * a saved match is only good as long as its directory is, which
+   * the attributes of a file, or the rules of an ignore file, can
+   * change without.
+   */
+  if (snapfile != NULL) {
+	if ((plan.flags & (OPT_DEL | OPT_EXEC | OPT_EMPTY | OPT_GRP | OPT_USR |
+					   OPT_NGRP | OPT_NUSR | OPT_SIZE | OPT_TIME |
+					   OPT_PERM | OPT_LINKS | OPT_STAT)) ||
+		plan.fmt != NULL || plan.args->need_ignore) {
+	  warnx("--snapshot only works with name, path and type filters");
+	  cleanup(0);
+	  exit (1);
+	}
+	if (init_snapshot(snapfile, argc, argv, &plan) < 0) {
+	  cleanup(0);
+	  exit (1);
+	}
+  }
+
+  /* what --global-sort holds would be lost. */
+  if (ckptfile != NULL) {
+	if (plan.args->need_gsort) {
+	  warnx("--checkpoint and --global-sort cannot be used together");
+	  cleanup(0);
+	  exit (1);
+	}
+	if (init_checkpoint(ckptfile, resume, argc, argv, &plan) < 0) {
+	  cleanup(0);
+	  exit (1);
+	}
+  }
+
+  /* sorting needs every child of a directory first. */
+  if (plan.args->need_sort || plan.snap != NULL)
+	plan.args->need_stream = 0;
+
   argc -= optind;
   argv += optind;
 
@@ -242,6 +528,266 @@ ftype_err(const char *s)
   return;
 }
 
+static __inline int
+num_arg(const char *opt, const char *s)
+{
+  long n;
+  char *ep;
+
+  errno = 0;
+  n = strtol(s, &ep, 10);
+  if (s[0] == '\0' || ep[0] != '\0' ||
+	  errno != 0 || n < 0 || n > INT_MAX) {
+	warnx("%s: %s: invalid number", opt, s);
+	cleanup(0);
+	exit (1);
+  }
+
+  return ((int)n);
+}
+
+/* a size in bytes, with an optional k, m or g suffix */
+static __inline size_t
+size_arg(const char *opt, const char *s)
+{
+  unsigned long long n;
+  char *ep;
+
+  errno = 0;
+  n = strtoull(s, &ep, 10);
+  switch (ep[0]) {
+  case 'g':
+  case 'G':
+	n *= 1024;
+	/* FALLTHROUGH */
+  case 'm':
+  case 'M':
+	n *= 1024;
+	/* FALLTHROUGH */
+  case 'k':
+  case 'K':
+	n *= 1024;
+	ep++;
+	break;
+  }
+
+  if (s[0] == '\0' || s[0] == '-' || ep[0] != '\0' ||
+	  errno != 0 || n == 0 || n > SIZE_MAX) {
+	warnx("%s: %s: invalid size", opt, s);
+	cleanup(0);
+	exit (1);
+  }
+
+  return ((size_t)n);
+}
+
+/*
+ * [+|-]n: more than, less than or exactly n. returns the sign, '='
+ * for none. where `unit' is given, n may carry a c, k, m or g
+ * suffix.
+ */
+static __inline char
+cmp_arg(const char *opt, const char *s, long long *n, long long *unit)
+{
+  char sign;
+  char *ep;
+  const char *arg = s;
+
+  sign = '=';
+  if (s[0] == '+' || s[0] == '-')
+	sign = *s++;
+
+  errno = 0;
+  *n = strtoll(s, &ep, 10);
+
+  if (unit != NULL) {
+	*unit = 1;
+	switch (ep[0]) {
+	case 'c':
+	  ep++;
+	  break;
+	case 'k':
+	case 'K':
+	  *unit = 1024LL;
+	  ep++;
+	  break;
+	case 'm':
+	case 'M':
+	  *unit = 1024LL * 1024;
+	  ep++;
+	  break;
+	case 'g':
+	case 'G':
+	  *unit = 1024LL * 1024 * 1024;
+	  ep++;
+	  break;
+	}
+	if (*n > LLONG_MAX / *unit)
+	  errno = ERANGE;
+  }
+
+  if (s[0] < '0' || s[0] > '9' || ep[0] != '\0' || errno != 0) {
+	warnx("%s: %s: invalid number", opt, arg);
+	cleanup(0);
+	exit (1);
+  }
+
+  return (sign);
+}
+
+/* sizes are rounded up to units of their suffix, as in find(1) */
+static __inline void
+count_arg(const char *opt, const char *s, range_t *r, int suffix)
+{
+  char sign;
+  long long n, unit;
+
+  unit = 1;
+  sign = cmp_arg(opt, s, &n, suffix ? &unit : NULL);
+
+  switch (sign) {
+  case '+':
+	r->lo = n * unit + 1;
+	r->hi = LLONG_MAX;
+	break;
+  case '-':
+	r->lo = 0;
+	r->hi = (n - 1) * unit;
+	break;
+  default:
+	r->lo = (n > 0) ? (n - 1) * unit + 1 : 0;
+	r->hi = n * unit;
+	break;
+  }
+}
+
+/* n units ago, truncated, into a range of timestamps */
+static __inline void
+time_arg(const char *opt, const char *s, long long unit, range_t *r)
+{
+  char sign;
+  long long n;
+
+  sign = cmp_arg(opt, s, &n, NULL);
+  if (n > (long long)now / unit) {
+	warnx("%s: %s: invalid number", opt, s);
+	cleanup(0);
+	exit (1);
+  }
+
+  switch (sign) {
+  case '+':
+	r->lo = LLONG_MIN;
+	r->hi = (long long)now - (n + 1) * unit;
+	break;
+  case '-':
+	r->lo = (long long)now - n * unit + 1;
+	r->hi = LLONG_MAX;
+	break;
+  default:
+	r->lo = (long long)now - (n + 1) * unit + 1;
+	r->hi = (long long)now - n * unit;
+	break;
+  }
+}
+
+static __inline void
+perm_arg(const char *s)
+{
+  long n;
+  char *ep;
+
+  plan.args->permop = '=';
+  if (s[0] == '-' || s[0] == '/')
+	plan.args->permop = *s++;
+
+  errno = 0;
+  n = strtol(s, &ep, 8);
+  if (s[0] == '\0' || ep[0] != '\0' || errno != 0 ||
+	  n < 0 || n > 07777) {
+	warnx("--perm: %s: invalid octal mode", s);
+	cleanup(0);
+	exit (1);
+  }
+
+  plan.args->perm = (mode_t)n;
+}
+
+/* I/N, the I-th of N shards counting from 0 */
+static __inline void
+shard_arg(const char *s)
+{
+  unsigned long i, n;
+  char *ep;
+
+  errno = 0;
+  n = 0;
+  i = strtoul(s, &ep, 10);
+  if (ep != s && ep[0] == '/' && ep[1] != '\0')
+	n = strtoul(ep + 1, &ep, 10);
+
+  if (ep[0] != '\0' || errno != 0 ||
+	  n == 0 || n > UINT_MAX || i >= n) {
+	warnx("--shard: %s: invalid shard, I/N with I < N expected", s);
+	cleanup(0);
+	exit (1);
+  }
+
+  plan.args->shard = (unsigned int)i;
+  plan.args->nshards = (unsigned int)n;
+}
+
+/*
+ * a name or a number of the password database, looked up here once, as
+ * the filter may never run on a node to report it.
+ */
+static __inline void
+user_arg(const char *s)
+{
+  long n;
+  char *ep;
+  struct passwd *pwd;
+
+  errno = 0;
+  n = strtol(s, &ep, 0);
+  if (s[0] != '\0' && ep[0] == '\0' && errno == 0)
+	pwd = getpwuid((uid_t)n);
+  else
+	pwd = getpwnam(s);
+
+  if (pwd == NULL) {
+	warnx("--user: %s: no such user", s);
+	cleanup(0);
+	exit (EX_NOUSER);
+  }
+
+  plan.args->uid = pwd->pw_uid;
+}
+
+/* as user_arg(), of the group database */
+static __inline void
+group_arg(const char *s)
+{
+  long n;
+  char *ep;
+  struct group *grp;
+
+  errno = 0;
+  n = strtol(s, &ep, 0);
+  if (s[0] != '\0' && ep[0] == '\0' && errno == 0)
+	grp = getgrgid((gid_t)n);
+  else
+	grp = getgrnam(s);
+
+  if (grp == NULL) {
+	warnx("--group: %s: no such group", s);
+	cleanup(0);
+	exit (EX_NOUSER);
+  }
+
+  plan.args->gid = grp->gr_gid;
+}
+
 static __inline void
 cleanup(int sig)
 {
@@ -255,15 +801,15 @@ cleanup(int sig)
 	plan.paths = NULL;
   }
 
-  if (plan.rfiles) {
-	dl_free(plan.rfiles);
-	plan.rfiles = NULL;
-  }
-
-  if (plan.rdirs) {
-	dl_free(plan.rdirs);
-	plan.rdirs = NULL;
-  }
+  free_ignore();
+  free_gsort(&(plan.gsort));
+  free_exec(&(plan.exec));
+  free_fmt(&(plan.fmt));
+  free_eval(&(plan.eval));
+  free_dupes(&(plan.dupes));
+  free_mounts(&(plan.mounts));
+  free_snapshot(&(plan.snap));
+  free_checkpoint(&(plan.ckpt));
 
   if (plan.mt != NULL) {
 	free(plan.mt);
@@ -271,6 +817,7 @@ cleanup(int sig)
   }
   
   if (plan.args != NULL) {
+	free_prune(&(plan.args->prune));
 	free(plan.args);
 	plan.args = NULL;
   }
@@ -285,3 +832,4 @@ cleanup(int sig)
 	exit(0);
   }
 }
+
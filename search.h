@@ -28,9 +28,16 @@
 #ifndef _SEARCH_H_
 #define _SEARCH_H_
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* statx(2) */
+#endif
+
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/param.h>
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
 
 #include <dirent.h>
 #include <err.h>
@@ -40,9 +47,11 @@
 #include <locale.h>
 #include <regex.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <mi/dlist.h>
@@ -68,6 +77,43 @@
 #define OPT_NUSR    0x010000
 #define OPT_VERSION 0x020000
 #define OPT_USAGE   0x040000
+#define OPT_EXEC    0x080000
+#define OPT_SIZE    0x100000
+#define OPT_TIME    0x200000
+#define OPT_PERM    0x400000
+#define OPT_LINKS   0x800000
+#define OPT_FSTYPE  0x1000000
+
+/* fields of nstat_t a plan depends on */
+#define NS_TYPE     0x01
+#define NS_UID      0x02
+#define NS_GID      0x04
+#define NS_SIZE     0x08
+#define NS_EMPTY    0x10
+#define NS_MTIME    0x20
+#define NS_CTIME    0x40
+#define NS_ATIME    0x80
+#define NS_MODE     0x100
+#define NS_NLINK    0x200
+#define NS_INO      0x400
+
+/* verdicts on a mounted file system */
+#define MT_SKIP     0x01
+#define MT_MATCH    0x02
+
+/* emit ops of --printf */
+#define F_LIT       0
+#define F_PATH      1
+#define F_BASE      2
+#define F_SIZE      3
+#define F_USER      4
+#define F_GROUP     5
+#define F_UID       6
+#define F_GID       7
+#define F_MTIME     8
+#define F_MDATE     9
+#define F_TYPE      10
+#define F_INO       11
 
 typedef enum _node {
   NT_UNKNOWN = DT_UNKNOWN,
@@ -92,19 +138,363 @@ typedef struct _nstat_t {
   uid_t uid;
   gid_t gid;
   dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  time_t ctime;
+  time_t atime;
+  mode_t mode;
+  nlink_t nlink;
   unsigned int empty;
   unsigned int flink;
   unsigned int mtype;
 } nstat_t;
 
+/* a value matches when lo <= value <= hi */
+typedef struct _range_t {
+  long long lo;
+  long long hi;
+} range_t;
+
+typedef struct _prune_t {
+  char *pattern;
+  unsigned int literal;
+  struct _prune_t *next;
+} prune_t;
+
+typedef struct _irule_t {
+  char *pattern;
+  unsigned int negate;
+  unsigned int dironly;
+  unsigned int anchored;
+  /* has a `**' component */
+  unsigned int dstar;
+} irule_t;
+
+/* compiled rules of one ignore file, cached by (dev, ino, mtime) */
+typedef struct _ignore_t {
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+  unsigned int size;
+  struct _irule_t *rules;
+  struct _ignore_t *next;
+} ignore_t;
+
+/* ignore files per directory, plus the global one */
+#define NIGNORE 4
+
+/* one frame per ignore file on the way from the root */
+typedef struct _istack_t {
+  struct _ignore_t *ign;
+  size_t baselen;
+  struct _istack_t *parent;
+} istack_t;
+
+/* nrec_t flags */
+#define NR_RMDIR    0x01
+/* --snapshot: a match, or a directory */
+#define NR_HIT      0x02
+#define NR_DIR      0x04
+
+/* a name at buf + off, NUL terminated */
+typedef struct _nrec_t {
+  size_t off;
+  unsigned int len;
+  unsigned int flags;
+  /* d_ino, for --inode-order */
+  ino_t ino;
+} nrec_t;
+
+typedef struct _arena_t {
+  char *buf;
+  size_t len;
+  size_t size;
+  struct _nrec_t *recs;
+  size_t nrecs;
+  size_t maxrecs;
+  /* next record to hand out */
+  size_t cur;
+} arena_t;
+
+/* a sorted run spilled by --global-sort */
+typedef struct _run_t {
+  FILE *fp;
+  /* lines of text, for --merge */
+  unsigned int text;
+  char *buf;
+  size_t len;
+  size_t size;
+} run_t;
+
+typedef struct _gsort_t {
+  struct _arena_t recs;
+  struct _run_t *runs;
+  unsigned int nruns;
+  /* a run could not be written out */
+  unsigned int failed;
+} gsort_t;
+
+typedef struct _dupe_t {
+  off_t size;
+  dev_t dev;
+  ino_t ino;
+  /* of the name in dupes_t.names */
+  size_t off;
+  uint64_t hash;
+  /* could not be read */
+  unsigned int bad;
+} dupe_t;
+
+typedef struct _dupes_t {
+  struct _arena_t names;
+  struct _dupe_t *recs;
+  size_t nrecs;
+  size_t maxrecs;
+  unsigned long ngroups;
+} dupes_t;
+
+typedef struct _fop_t {
+  int op;
+  /* text of F_LIT */
+  const char *lit;
+  size_t len;
+} fop_t;
+
+/* a compiled --printf or --json-lines format */
+typedef struct _fmt_t {
+  struct _fop_t *ops;
+  int nops;
+  int maxops;
+  /* the format, with escapes resolved */
+  char *text;
+  /* strings are quoted for JSON */
+  unsigned int json;
+  /* NS_* fields the ops use */
+  unsigned int need;
+} fmt_t;
+
+typedef struct _exec_t {
+  /* the command, without the `{}' of a batch */
+  char **argv;
+  int argc;
+  /* argv with `{}' replaced */
+  char **av;
+  /* `+' rather than `;' */
+  unsigned int batch;
+  /* results of the pending batch */
+  struct _arena_t names;
+  size_t nbytes;
+  /* bytes taken by argv, and the most allowed */
+  size_t used;
+  size_t argmax;
+  unsigned int njobs;
+  unsigned int nrunning;
+} exec_t;
+
+/* a directory on the way down, or already walked, with -L */
+typedef struct _dino_t {
+  dev_t dev;
+  ino_t ino;
+  unsigned int used;
+  unsigned int onpath;
+} dino_t;
+
+/* open addressing set of dino_t, size a power of two */
+typedef struct _dset_t {
+  struct _dino_t *tab;
+  size_t size;
+  size_t n;
+} dset_t;
+
+/* where a directory is in the old --snapshot */
+typedef struct _snapent_t {
+  size_t off;
+  unsigned int used;
+  /* written to the new one as well */
+  unsigned int seen;
+} snapent_t;
+
+typedef struct _snap_t {
+  char *path;
+  /* the new snapshot, renamed over path when done */
+  char *tmppath;
+  FILE *out;
+  unsigned int error;
+  /* when it was started */
+  time_t start;
+  /* the old snapshot, and an open addressing index of it */
+  char *buf;
+  size_t len;
+  struct _snapent_t *tab;
+  size_t size;
+  unsigned long nreused;
+} snap_t;
+
+/* ckpt_due */
+#define CKPT_TIMER  1
+#define CKPT_STOP   2
+
+/* a frame saved by --checkpoint */
+typedef struct _cframe_t {
+  char *path;
+  int depth;
+  unsigned int deldir;
+  /* saved while its directory was read, `nread' entries into it */
+  unsigned int partial;
+  unsigned long nread;
+  /* the position of the next name to visit, and that name */
+  size_t cur;
+  char *name;
+  /* with --stream, the directories yet to be visited */
+  struct _arena_t names;
+} cframe_t;
+
+typedef struct _ckpt_t {
+  char *path;
+  char *tmppath;
+  /* the options, as for --snapshot */
+  struct _arena_t sig;
+  /* --resume: where the walk was */
+  unsigned long nmatch;
+  unsigned long root;
+  struct _cframe_t *frames;
+  int nframes;
+  /* the frame being rebuilt, while resuming is set */
+  int next;
+  unsigned int resuming;
+  /* a signal ended the walk */
+  unsigned int stopped;
+} ckpt_t;
+
+/* a mounted file system, by st_dev */
+typedef struct _mnt_t {
+  dev_t dev;
+  unsigned int used;
+  /* MT_* */
+  unsigned int flags;
+} mnt_t;
+
+/* open addressing table of mnt_t, size a power of two */
+typedef struct _mtab_t {
+  struct _mnt_t *tab;
+  size_t size;
+  size_t n;
+} mtab_t;
+
+/* what --stats tells of a device */
+typedef struct _devstat_t {
+  dev_t dev;
+  unsigned long ndirs;
+  /* "." and ".." aside */
+  unsigned long nentries;
+  /* time spent reading its directories, in nanoseconds */
+  unsigned long long nsecs;
+} devstat_t;
+
+/* the attributes of a child, looked up ahead by --io-uring */
+typedef struct _pstat_t {
+  /* its lookup is in flight */
+  unsigned int busy;
+  unsigned int done;
+  int err;
+  struct stat sb;
+} pstat_t;
+
+/* a directory being walked through */
+typedef struct _frame_t {
+  DIR *dirp;
+  /* children yet to be visited, with --stream only directories */
+  struct _arena_t names;
+  /* length of the directory's path */
+  size_t len;
+  int depth;
+  /* --delete it once its children are gone */
+  unsigned int deldir;
+  /* its entry in the dset_t of -L, if any */
+  dev_t dev;
+  ino_t ino;
+  unsigned int indset;
+  /* --snapshot: its timestamps, whether its children came from the
+	 old snapshot, and those to record */
+  unsigned int insnap;
+  time_t mtime;
+  time_t ctime;
+  unsigned int reused;
+  struct _arena_t snap;
+  /* nearest frame with dirp open, or -1 */
+  int anchor;
+  /* --io-uring: the children from pfrom on, npst of them, queued
+	 in pst by their index modulo its size, and the lookups of
+	 children in flight */
+  struct _pstat_t *pst;
+  size_t pfrom;
+  size_t npst;
+  unsigned int nflight;
+  /* --checkpoint: saved before it was read to the end */
+  unsigned int partial;
+  unsigned long nread;
+  struct _istack_t ifr[NIGNORE];
+  struct _istack_t *ign;
+} frame_t;
+
+typedef struct _walk_t {
+  struct _frame_t **stack;
+  int top;
+  int max;
+  /* path of the node being visited */
+  char *path;
+  size_t size;
+} walk_t;
+
 typedef struct _args_t {
   NODE type;
-  char suid[LINE_MAX];
-  char sgid[LINE_MAX];
+  /* --user and --group, looked up while the options are read */
+  uid_t uid;
+  gid_t gid;
   dev_t odev;
   unsigned int empty;
+  struct _range_t size;
+  struct _range_t links;
+  /* NS_MTIME, NS_CTIME and NS_ATIME of the ranges below in use */
+  unsigned int need_time;
+  struct _range_t mtime;
+  struct _range_t ctime;
+  struct _range_t atime;
+  mode_t perm;
+  /* '=' exactly, '-' all of, '/' any of the bits in perm */
+  char permop;
   unsigned int need_sort;
+  unsigned int need_inosort;
   unsigned int need_xdev;
+  unsigned int need_ignore;
+  unsigned int need_stat;
+  unsigned int need_stream;
+  unsigned int need_gsort;
+  unsigned int need_stats;
+  unsigned int need_uring;
+  /* --global-sort memory budget */
+  size_t sortmem;
+  /* stop after this many results, 0 for no limit */
+  unsigned long maxresults;
+  /* -L, symbolic links are followed */
+  unsigned int follow;
+  /* with -L, descend a directory only once however it is reached */
+  unsigned int once;
+  /* possibly stale attributes are fine */
+  unsigned int nosync;
+  int mindepth;
+  int maxdepth;
+  /* --shard: this one of nshards, split at sharddepth */
+  unsigned int shard;
+  unsigned int nshards;
+  int sharddepth;
+  /* --files-from: the paths to visit instead of walking, "-" for stdin */
+  const char *filesfrom;
+  /* -0, they end with a NUL rather than a newline */
+  unsigned int null;
+  /* names never descended into */
+  struct _prune_t *prune;
 } args_t;
 
 typedef struct _plist_t {
@@ -112,6 +502,8 @@ typedef struct _plist_t {
   struct _plan *start;
   struct _plan *cur;
   unsigned int size;
+  /* nodes filtered through the list, for plan_reorder() */
+  unsigned long nvisits;
 } plist_t;
 
 typedef struct _plan_t {
@@ -120,18 +512,71 @@ typedef struct _plan_t {
   struct _args_t *args;
   struct _plist_t *plans;
   struct _nstat_t *nstat;
+  /* a specialized evaluator of plans, or NULL */
+  struct _eval_t *eval;
+  /* a directory above the node being walked through, or -1 */
+  int pfd;
+  /* offset of the node's path relative to pfd */
+  size_t poff;
+  /* its attributes, when --io-uring has them already */
+  struct _pstat_t *pst;
+  /* innermost ignore file for --ignore-files */
+  struct _istack_t *ignores;
+  struct _exec_t *exec;
+  /* --printf, or NULL for plain paths */
+  struct _fmt_t *fmt;
+  /* results held back by --global-sort */
+  struct _gsort_t *gsort;
+  /* regular files held back by --duplicates */
+  struct _dupes_t *dupes;
+  /* directories followed with -L */
+  struct _dset_t dirs;
+  struct _snap_t *snap;
+  struct _ckpt_t *ckpt;
+  /* position of the starting point in paths, and its length */
+  unsigned long root;
+  size_t rootlen;
+  /* the mount table, and the device of the starting point */
+  struct _mtab_t *mounts;
+  dev_t rootdev;
+  /* per device counts of --stats */
+  struct _devstat_t *devs;
+  unsigned int ndevs;
+  /* set by s_delete() on a directory */
+  unsigned int deldir;
+  /* results so far */
+  unsigned long nmatch;
+  unsigned long ndeleted;
+  unsigned long nfailed;
+  /* set to end the walk early */
+  unsigned int stop;
   struct dlist *paths;
-  /* files to be deleted */
-  struct dlist *rfiles;
-  /* dirs to be deleted */
-  struct dlist *rdirs;
 } plan_t;
 
+typedef struct _eval_t {
+  /* the filters of a node, in place of the PLAN list */
+  int (*fn)(const char *, struct _plan_t *, int);
+  int (*stat)(const char *, struct _plan_t *);
+  const char *pattern;
+  int fnflags;
+  regex_t re;
+  unsigned int hasre;
+  NODE type;
+  uid_t uid;
+} eval_t;
+
 typedef struct _plan {
   unsigned int exec;
   char *func_name;
   int (*s_func) (const char *, struct _plan_t *);
   struct _plan *next;
+  /* may run in any order with the others, see plan_reorder() */
+  unsigned int free;
+  /* calls and rejections, and the time taken by the sampled calls */
+  unsigned long ncalls;
+  unsigned long nfails;
+  unsigned long ntimed;
+  unsigned long long nsecs;
 } PLAN;
 
 typedef struct flags_t {
@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2005-2010 Denise H. G. <darcsis@gmail.com>
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * --snapshot: remember, for every directory walked through, its
+ * identity and timestamps along with the children that matched or
+ * are directories. the next run takes those instead of reading a
+ * directory that did not change since.
+ */
+
+#include "search.h"
+
+#define SNAP_MAGIC "search snapshot 1\n"
+
+/* what precedes the children of a directory in the file */
+typedef struct _snaphdr_t {
+  uint64_t dev;
+  uint64_t ino;
+  int64_t mtime;
+  int64_t ctime;
+  /* bytes of children: a flags byte and a name each */
+  uint32_t len;
+} snaphdr_t;
+
+extern int arena_add(arena_t *, const char *);
+
+static int  snap_load(snap_t *, arena_t *);
+static size_t snap_hash(dev_t, ino_t, size_t);
+static snapent_t *snap_find(snap_t *, dev_t, ino_t, snaphdr_t *);
+
+int  snap_sig(int, char **, arena_t *);
+int  init_snapshot(const char *, int, char **, plan_t *);
+int  snap_lookup(frame_t *, plan_t *);
+void snap_record(frame_t *, arena_t *, plan_t *);
+void snap_finish(plan_t *);
+void free_snapshot(snap_t **);
+
+/*
+ * the options and the working directory, which the saved results
+ * depend on. the files to save them to, and --stats, do not count.
+ * also used by --checkpoint.
+ */
+int
+snap_sig(int argc, char **argv, arena_t *sig)
+{
+  int i, j;
+  size_t n;
+  char cwd[MAXPATHLEN];
+  static const char *files[] = {
+	"--snapshot", "--checkpoint", "--resume", NULL
+  };
+
+  if (getcwd(cwd, MAXPATHLEN) == NULL)
+	cwd[0] = '\0';
+  if (arena_add(sig, cwd) < 0)
+	return (-1);
+
+  for (i = 1; i < argc; i++) {
+	for (j = 0; files[j] != NULL; j++) {
+	  n = strlen(files[j]);
+	  if (strncmp(argv[i], files[j], n) == 0 &&
+		  (argv[i][n] == '\0' || argv[i][n] == '='))
+		break;
+	}
+	if (files[j] != NULL) {
+	  if (argv[i][strlen(files[j])] == '\0')
+		i++;
+	  continue;
+	}
+	if (strcmp(argv[i], "--stats") == 0)
+	  continue;
+	if (arena_add(sig, argv[i]) < 0)
+	  return (-1);
+  }
+
+  return (0);
+}
+
+static size_t
+snap_hash(dev_t dev, ino_t ino, size_t size)
+{
+  uint64_t h;
+
+  h = ((uint64_t)ino ^ ((uint64_t)dev << 32 | (uint64_t)dev >> 32)) *
+	0x9e3779b97f4a7c15ULL;
+
+  return ((size_t)(h >> 32) & (size - 1));
+}
+
+/* the entry of a directory in the old snapshot, with its header */
+static snapent_t *
+snap_find(snap_t *sn, dev_t dev, ino_t ino, snaphdr_t *hdr)
+{
+  size_t n;
+
+  if (sn->tab == NULL)
+	return (NULL);
+
+  for (n = snap_hash(dev, ino, sn->size); sn->tab[n].used;
+	   n = (n + 1) & (sn->size - 1)) {
+	memcpy(hdr, sn->buf + sn->tab[n].off, sizeof(snaphdr_t));
+	if (hdr->dev == (uint64_t)dev && hdr->ino == (uint64_t)ino)
+	  return (&(sn->tab[n]));
+  }
+
+  return (NULL);
+}
+
+/* read the old snapshot, if it was taken with the same options */
+static int
+snap_load(snap_t *sn, arena_t *sig)
+{
+  size_t off, n, nrecs;
+  long size;
+  uint32_t siglen;
+  snaphdr_t hdr;
+  FILE *fp;
+
+  if ((fp = fopen(sn->path, "r")) == NULL)
+	return ((errno == ENOENT) ? (0) : (-1));
+
+  if (fseek(fp, 0, SEEK_END) < 0 || (size = ftell(fp)) < 0) {
+	fclose(fp);
+	return (-1);
+  }
+  rewind(fp);
+
+  if ((sn->buf = (char *)malloc(size + 1)) == NULL ||
+	  fread(sn->buf, 1, size, fp) != (size_t)size) {
+	fclose(fp);
+	return (-1);
+  }
+  fclose(fp);
+  sn->len = size;
+
+  sn->buf[sn->len] = '\0';
+
+  off = strlen(SNAP_MAGIC);
+  siglen = (uint32_t)sig->len;
+  if (sn->len < off + sizeof(siglen) + sig->len ||
+	  memcmp(sn->buf, SNAP_MAGIC, off) != 0 ||
+	  memcmp(sn->buf + off, &siglen, sizeof(siglen)) != 0 ||
+	  memcmp(sn->buf + off + sizeof(siglen), sig->buf, sig->len) != 0) {
+#ifdef _DEBUG_
+	warnx("%s: taken with other options", sn->path);
+#endif
+	return (0);
+  }
+  off += sizeof(siglen) + sig->len;
+
+  /* count the directories, then index them */
+  for (nrecs = 0, n = off; n + sizeof(hdr) <= sn->len; nrecs++) {
+	memcpy(&hdr, sn->buf + n, sizeof(hdr));
+	n += sizeof(hdr) + hdr.len;
+  }
+  if (n != sn->len) {
+	warnx("%s: truncated snapshot", sn->path);
+	return (0);
+  }
+
+  for (sn->size = 256; sn->size < nrecs * 2 + 2; sn->size *= 2)
+	;
+  if ((sn->tab = (snapent_t *)calloc(sn->size, sizeof(snapent_t))) == NULL)
+	return (-1);
+
+  while (off < sn->len) {
+	memcpy(&hdr, sn->buf + off, sizeof(hdr));
+	for (n = snap_hash(hdr.dev, hdr.ino, sn->size); sn->tab[n].used;
+		 n = (n + 1) & (sn->size - 1))
+	  ;
+	sn->tab[n].used = 1;
+	sn->tab[n].off = off;
+	off += sizeof(hdr) + hdr.len;
+  }
+
+  return (0);
+}
+
+/*
+ * load `file' and start the new snapshot next to it, to be renamed
+ * over it once the walk is done.
+ */
+int
+init_snapshot(const char *file, int argc, char **argv, plan_t *p)
+{
+  int fd;
+  uint32_t siglen;
+  arena_t sig;
+  snap_t *sn;
+
+  if (file == NULL || p == NULL)
+	return (-1);
+
+  if ((sn = (snap_t *)malloc(sizeof(snap_t))) == NULL)
+	return (-1);
+  bzero(sn, sizeof(snap_t));
+  bzero(&sig, sizeof(arena_t));
+
+  if ((sn->path = strdup(file)) == NULL ||
+	  (sn->tmppath = (char *)malloc(strlen(file) + 10)) == NULL ||
+	  snap_sig(argc, argv, &sig) < 0)
+	goto fail;
+
+  if (snap_load(sn, &sig) < 0) {
+	warn("%s", file);
+	goto fail;
+  }
+
+  snprintf(sn->tmppath, strlen(file) + 10, "%s.XXXXXXX", file);
+  if ((fd = mkstemp(sn->tmppath)) < 0) {
+	warn("%s", sn->tmppath);
+	goto fail;
+  }
+  if ((sn->out = fdopen(fd, "w")) == NULL) {
+	warn("%s", sn->tmppath);
+	close(fd);
+	(void)unlink(sn->tmppath);
+	goto fail;
+  }
+
+  siglen = (uint32_t)sig.len;
+  if (fputs(SNAP_MAGIC, sn->out) == EOF ||
+	  fwrite(&siglen, sizeof(siglen), 1, sn->out) != 1 ||
+	  fwrite(sig.buf, 1, sig.len, sn->out) != sig.len)
+	sn->error = 1;
+
+  free(sig.buf);
+  free(sig.recs);
+  sn->start = time(NULL);
+  p->snap = sn;
+
+  return (0);
+
+ fail:
+  free(sig.buf);
+  free(sig.recs);
+  free_snapshot(&sn);
+  return (-1);
+}
+
+/*
+ * the directory of `f' is open. if it is in the old snapshot with
+ * the same timestamps, fill in its children from there, flagged
+ * NR_HIT and NR_DIR, and return 1.
+ */
+int
+snap_lookup(frame_t *f, plan_t *p)
+{
+  size_t off, end;
+  struct stat stbuf;
+  snaphdr_t hdr;
+  snapent_t *e;
+  snap_t *sn;
+
+  sn = p->snap;
+  f->insnap = 0;
+
+  if (fstat(dirfd(f->dirp), &stbuf) < 0)
+	return (0);
+
+  f->insnap = 1;
+  f->dev = stbuf.st_dev;
+  f->ino = stbuf.st_ino;
+  f->mtime = stbuf.st_mtime;
+  f->ctime = stbuf.st_ctime;
+
+  /* ctime catches what mtime alone would miss, like a rename */
+  if ((e = snap_find(sn, f->dev, f->ino, &hdr)) == NULL ||
+	  hdr.mtime != (int64_t)f->mtime ||
+	  hdr.ctime != (int64_t)f->ctime)
+	return (0);
+
+  off = e->off + sizeof(hdr);
+  end = off + hdr.len;
+  while (off < end) {
+	if (arena_add(&(f->names), sn->buf + off + 1) == 0)
+	  f->names.recs[f->names.nrecs - 1].flags = sn->buf[off];
+	off += strlen(sn->buf + off + 1) + 2;
+  }
+
+  sn->nreused++;
+  return (1);
+}
+
+/* write out the children of `f' kept in `ar' */
+void
+snap_record(frame_t *f, arena_t *ar, plan_t *p)
+{
+  size_t i;
+  unsigned char fl;
+  const char *s;
+  snaphdr_t hdr;
+  snapent_t *e;
+  snap_t *sn;
+
+  if ((sn = p->snap) == NULL || sn->error || !f->insnap)
+	return;
+
+  /* not to be carried over by snap_finish() */
+  if ((e = snap_find(sn, f->dev, f->ino, &hdr)) != NULL)
+	e->seen = 1;
+
+  bzero(&hdr, sizeof(hdr));
+  hdr.dev = f->dev;
+  hdr.ino = f->ino;
+  hdr.mtime = f->mtime;
+  hdr.ctime = f->ctime;
+  /*
+   * timestamps have a coarse granularity: a directory changed in the
+   * second it was read might still look the same next time, so it
+   * is never taken as unchanged, much like git(1) does for its index.
+   */
+  if (f->mtime >= sn->start - 1 || f->ctime >= sn->start - 1)
+	hdr.mtime = hdr.ctime = -1;
+  for (i = 0; i < ar->nrecs; i++)
+	hdr.len += ar->recs[i].len + 2;
+
+  if (fwrite(&hdr, sizeof(hdr), 1, sn->out) != 1)
+	sn->error = 1;
+
+  for (i = 0; i < ar->nrecs; i++) {
+	fl = (unsigned char)(ar->recs[i].flags & (NR_HIT | NR_DIR));
+	s = ar->buf + ar->recs[i].off;
+	if (fputc(fl, sn->out) == EOF ||
+		fwrite(s, 1, ar->recs[i].len + 1, sn->out) != ar->recs[i].len + 1)
+	  sn->error = 1;
+  }
+}
+
+/*
+ * replace the old snapshot, unless the walk was cut short. a walk
+ * resumed from --checkpoint did not go through the directories walked
+ * before it was interrupted, nor those it was rebuilt with: they keep
+ * what the old snapshot had, which is checked by their times as ever.
+ */
+void
+snap_finish(plan_t *p)
+{
+  size_t n;
+  snaphdr_t hdr;
+  snap_t *sn;
+
+  if (p == NULL || (sn = p->snap) == NULL || sn->out == NULL)
+	return;
+
+  if (p->ckpt != NULL && p->ckpt->nframes > 0 && !p->stop) {
+	for (n = 0; n < sn->size && !sn->error; n++) {
+	  if (!sn->tab[n].used || sn->tab[n].seen)
+		continue;
+	  memcpy(&hdr, sn->buf + sn->tab[n].off, sizeof(hdr));
+	  if (fwrite(sn->buf + sn->tab[n].off, 1, sizeof(hdr) + hdr.len,
+				 sn->out) != sizeof(hdr) + hdr.len)
+		sn->error = 1;
+	}
+  }
+
+  if (fflush(sn->out) == EOF || fsync(fileno(sn->out)) < 0)
+	sn->error = 1;
+  fclose(sn->out);
+  sn->out = NULL;
+
+  if (sn->error || p->stop) {
+	if (sn->error)
+	  warnx("%s: snapshot not updated", sn->path);
+	(void)unlink(sn->tmppath);
+	return;
+  }
+
+  if (rename(sn->tmppath, sn->path) < 0) {
+	warn("%s", sn->path);
+	(void)unlink(sn->tmppath);
+  }
+}
+
+void
+free_snapshot(snap_t **snap)
+{
+  snap_t *sn = *snap;
+
+  if (sn == NULL)
+	return;
+
+  /* interrupted: leave the old snapshot as it was */
+  if (sn->out != NULL) {
+	fclose(sn->out);
+	(void)unlink(sn->tmppath);
+  }
+
+  free(sn->path);
+  free(sn->tmppath);
+  free(sn->buf);
+  free(sn->tab);
+  free(sn);
+  *snap = NULL;
+}
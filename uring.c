@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2005-2010 Denise H. G. <darcsis@gmail.com>
+ * All rights reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * --io-uring: on Linux, the attributes of the children of a directory
+ * are looked up ahead of the walk with IORING_OP_STATX requests, of
+ * which up to NURING are in flight. as the walk takes a child, the
+ * request of another one goes in, so the lookups of a file system
+ * with a high latency, such as NFS, overlap instead of waiting for
+ * one another, and none is more than NURING children old when it is
+ * used. where io_uring is not there, or cannot do statx, nodestat()
+ * looks the nodes up itself.
+ */
+
+#include "search.h"
+
+#if defined(_Linux_) && defined(STATX_TYPE)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <fcntl.h>
+
+#include <linux/io_uring.h>
+
+/* requests in flight, and children of a directory looked up ahead */
+#define NURING 64
+
+extern unsigned int statx_mask(plan_t *);
+extern void statx_conv(const struct statx *, struct stat *);
+
+static struct _ring {
+  int fd;
+  unsigned int *sqhead;
+  unsigned int *sqtail;
+  unsigned int *sqmask;
+  unsigned int *sqarray;
+  unsigned int *cqhead;
+  unsigned int *cqtail;
+  unsigned int *cqmask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq;
+  void *cq;
+  size_t sqsize;
+  size_t cqsize;
+  size_t sqesize;
+  unsigned int entries;
+} ring = { -1 };
+
+/*
+ * a request in flight, the index of which is its user_data. those of
+ * a directory may still be in flight when the walk goes into another.
+ */
+static struct _req {
+  frame_t *f;
+  pstat_t *ps;
+  struct statx stx;
+} reqs[NURING];
+
+static unsigned int freeq[NURING];
+static unsigned int nfree;
+/* the kernel has no IORING_OP_STATX */
+static int nostatx;
+
+static void uring_close(void);
+static int  uring_enter(unsigned int, unsigned int);
+static void uring_fill(frame_t *, plan_t *);
+static int  uring_reap(unsigned int);
+
+int  init_uring(plan_t *);
+pstat_t *uring_stat(frame_t *, size_t, plan_t *);
+void uring_drain(frame_t *);
+
+static void
+uring_close(void)
+{
+  if (ring.sqes != NULL)
+	munmap(ring.sqes, ring.sqesize);
+  if (ring.cq != NULL && ring.cq != ring.sq)
+	munmap(ring.cq, ring.cqsize);
+  if (ring.sq != NULL)
+	munmap(ring.sq, ring.sqsize);
+  if (ring.fd >= 0)
+	close(ring.fd);
+
+  bzero(&ring, sizeof(ring));
+  ring.fd = -1;
+}
+
+static int
+uring_enter(unsigned int submit, unsigned int wait)
+{
+  int ret;
+
+  do {
+	ret = (int)syscall(__NR_io_uring_enter, ring.fd, submit, wait,
+					   IORING_ENTER_GETEVENTS, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+
+  return (ret);
+}
+
+/* set up the ring, -1 when the kernel has none to give */
+int
+init_uring(plan_t *p __unused)
+{
+  struct io_uring_params par;
+
+  if (ring.fd >= 0)
+	return (0);
+
+  bzero(&par, sizeof(par));
+  if ((ring.fd = (int)syscall(__NR_io_uring_setup, NURING, &par)) < 0) {
+#ifdef _DEBUG_
+	warn("io_uring_setup");
+#endif
+	ring.fd = -1;
+	return (-1);
+  }
+
+  ring.entries = par.sq_entries;
+  ring.sqsize = par.sq_off.array + par.sq_entries * sizeof(unsigned int);
+  ring.cqsize = par.cq_off.cqes +
+	par.cq_entries * sizeof(struct io_uring_cqe);
+  if (par.features & IORING_FEAT_SINGLE_MMAP) {
+	if (ring.cqsize > ring.sqsize)
+	  ring.sqsize = ring.cqsize;
+	ring.cqsize = ring.sqsize;
+  }
+
+  ring.sq = mmap(NULL, ring.sqsize, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+  if (ring.sq == MAP_FAILED) {
+	ring.sq = NULL;
+	uring_close();
+	return (-1);
+  }
+
+  if (par.features & IORING_FEAT_SINGLE_MMAP)
+	ring.cq = ring.sq;
+  else if ((ring.cq = mmap(NULL, ring.cqsize, PROT_READ | PROT_WRITE,
+						   MAP_SHARED | MAP_POPULATE, ring.fd,
+						   IORING_OFF_CQ_RING)) == MAP_FAILED) {
+	ring.cq = NULL;
+	uring_close();
+	return (-1);
+  }
+
+  ring.sqesize = par.sq_entries * sizeof(struct io_uring_sqe);
+  if ((ring.sqes = mmap(NULL, ring.sqesize, PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE, ring.fd,
+						IORING_OFF_SQES)) == MAP_FAILED) {
+	ring.sqes = NULL;
+	uring_close();
+	return (-1);
+  }
+
+  ring.sqhead = (unsigned int *)((char *)ring.sq + par.sq_off.head);
+  ring.sqtail = (unsigned int *)((char *)ring.sq + par.sq_off.tail);
+  ring.sqmask = (unsigned int *)((char *)ring.sq + par.sq_off.ring_mask);
+  ring.sqarray = (unsigned int *)((char *)ring.sq + par.sq_off.array);
+  ring.cqhead = (unsigned int *)((char *)ring.cq + par.cq_off.head);
+  ring.cqtail = (unsigned int *)((char *)ring.cq + par.cq_off.tail);
+  ring.cqmask = (unsigned int *)((char *)ring.cq + par.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *)((char *)ring.cq + par.cq_off.cqes);
+
+  for (nfree = 0; nfree < NURING; nfree++)
+	freeq[nfree] = nfree;
+
+  (void)atexit(uring_close);
+
+  return (0);
+}
+
+/*
+ * queue the lookups of the children of `f' after those it has in the
+ * ring, as long as it has fewer than NURING of them and the ring has
+ * room. a slot still waited on, for a child the walk went past, is
+ * not given away.
+ */
+static void
+uring_fill(frame_t *f, plan_t *p)
+{
+  int fd, atflag;
+  unsigned int mask, tail, idx, r;
+  size_t j;
+  struct io_uring_sqe *sqe;
+  pstat_t *ps;
+
+  fd = dirfd(f->dirp);
+  mask = statx_mask(p);
+  atflag = p->args->follow ? 0 : AT_SYMLINK_NOFOLLOW;
+  if (p->args->nosync)
+	atflag |= AT_STATX_DONT_SYNC;
+
+  tail = *ring.sqtail;
+  while (f->npst < NURING && nfree > 0 &&
+		 (j = f->pfrom + f->npst) < f->names.nrecs) {
+	ps = &(f->pst[j % NURING]);
+	if (ps->busy)
+	  break;
+	ps->busy = 1;
+	ps->done = 0;
+
+	r = freeq[--nfree];
+	reqs[r].f = f;
+	reqs[r].ps = ps;
+
+	idx = tail & *ring.sqmask;
+	sqe = &(ring.sqes[idx]);
+	bzero(sqe, sizeof(*sqe));
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)(f->names.buf + f->names.recs[j].off);
+	sqe->len = mask;
+	sqe->off = (uint64_t)(uintptr_t)&(reqs[r].stx);
+	sqe->statx_flags = atflag;
+	sqe->user_data = r;
+	ring.sqarray[idx] = idx;
+	tail++;
+
+	f->nflight++;
+	f->npst++;
+  }
+  __atomic_store_n(ring.sqtail, tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * submit what is queued, wait for `wait' requests to complete, and
+ * put the results of those done where they belong.
+ */
+static int
+uring_reap(unsigned int wait)
+{
+  unsigned int head, submit;
+  struct io_uring_cqe *cqe;
+  struct _req *r;
+
+  submit = *ring.sqtail - __atomic_load_n(ring.sqhead, __ATOMIC_ACQUIRE);
+  if ((submit > 0 || wait > 0) && uring_enter(submit, wait) < 0) {
+	/* what is not done yet is looked up by nodestat() */
+	warn("io_uring_enter");
+	uring_close();
+	return (-1);
+  }
+
+  head = *ring.cqhead;
+  while (head != __atomic_load_n(ring.cqtail, __ATOMIC_ACQUIRE)) {
+	cqe = &(ring.cqes[head & *ring.cqmask]);
+	r = &(reqs[cqe->user_data]);
+	if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+	  /* a kernel without IORING_OP_STATX */
+	  r->ps->done = 0;
+	  nostatx = 1;
+	} else {
+	  r->ps->done = 1;
+	  r->ps->err = (cqe->res < 0) ? -cqe->res : 0;
+	  if (cqe->res >= 0)
+		statx_conv(&(r->stx), &(r->ps->sb));
+	}
+	r->ps->busy = 0;
+	r->f->nflight--;
+	freeq[nfree++] = (unsigned int)cqe->user_data;
+	head++;
+  }
+  __atomic_store_n(ring.cqhead, head, __ATOMIC_RELEASE);
+
+  return (0);
+}
+
+/*
+ * the attributes of the `i'th child of `f', once its lookup is done,
+ * the children after it going into the ring meanwhile. those before
+ * it are done with. NULL when nodestat() is to look it up itself.
+ */
+pstat_t *
+uring_stat(frame_t *f, size_t i, plan_t *p)
+{
+  unsigned int ready;
+  pstat_t *ps;
+
+  if (ring.fd < 0 || nostatx || f->dirp == NULL || f->reused)
+	return (NULL);
+
+  if (f->pst == NULL &&
+	  (f->pst = (pstat_t *)calloc(NURING, sizeof(pstat_t))) == NULL)
+	return (NULL);
+
+  /* the children from pfrom on, npst of them, have been queued */
+  if (i >= f->pfrom && i <= f->pfrom + f->npst)
+	f->npst -= i - f->pfrom;
+  else
+	f->npst = 0;
+  f->pfrom = i;
+
+  for (;;) {
+	uring_fill(f, p);
+	ps = &(f->pst[i % NURING]);
+	ready = (f->npst > 0 && !ps->busy);
+	if (uring_reap(ready ? 0 : 1) < 0 || nostatx)
+	  return (NULL);
+	if (ready)
+	  break;
+  }
+
+  return (ps->done ? ps : NULL);
+}
+
+/*
+ * wait for what `f' has in flight, before its directory is closed or
+ * its names are let go of.
+ */
+void
+uring_drain(frame_t *f)
+{
+  while (f->nflight > 0 && ring.fd >= 0) {
+	if (uring_reap(1) < 0)
+	  break;
+  }
+  if (ring.fd < 0)
+	f->nflight = 0;
+}
+
+#else	/* !_Linux_ */
+
+int  init_uring(plan_t *);
+pstat_t *uring_stat(frame_t *, size_t, plan_t *);
+void uring_drain(frame_t *);
+
+int
+init_uring(plan_t *p __unused)
+{
+  return (-1);
+}
+
+pstat_t *
+uring_stat(frame_t *f __unused, size_t i __unused, plan_t *p __unused)
+{
+  return (NULL);
+}
+
+void
+uring_drain(frame_t *f __unused)
+{
+}
+
+#endif	/* _Linux_ */